@@ -0,0 +1,94 @@
+#pragma once
+#include "protobuf.h"
+
+// Cached encodings
+// A Cached<PS> holds a message together with its encoding, made the first time it is needed and kept until the
+// message is changed through one of the mutating accessors. Writing an unchanged Cached, on its own or as a
+// member (plain, optional or repeated) of a larger message, copies the kept bytes instead of encoding again, so
+// a message sent to many peers is encoded once, and re-encoding a large message whose parts are mostly unchanged
+// costs little more than a copy. On the wire a Cached<PS> is exactly a PS.
+//
+//     Cached<MarketState> state{snapshot()};
+//     for (auto& peer : peers)
+//         peer << state;                      // encoded for the first peer only, then copied
+//     state.edit().last_price = 101;          // encoded again by the next write
+//
+// The reference edit() returns must not be held past the next write, which would keep the old bytes. The
+// encoding is made lazily by a const accessor, so a Cached that has been changed must not be written by two
+// threads at once; calling bytes() before sharing it makes every later write read-only.
+
+template<ProtoStruct PS>
+class Cached
+{
+    PS obj{};
+    mutable DataBlock encoded;
+    mutable bool valid{false};
+public:
+    using message_type = PS;
+
+    Cached() = default;
+    Cached(PS msg) : obj(std::move(msg)) {}
+
+    const PS& get() const { return obj; }
+    const PS& operator*() const { return obj; }
+    const PS* operator->() const { return &obj; }
+
+    // the mutating accessors, each drops the kept encoding
+    PS& edit() { valid = false; return obj; }
+    Cached& operator=(PS msg) { obj = std::move(msg); valid = false; return *this; }
+
+    // the encoding of the message, as "tgt << get()" would write it
+    ConstDataBlock bytes() const
+    {
+        if (!valid)
+        {
+            encoded.clear();    // keeps the capacity
+            encoded << obj;
+            valid = true;
+        }
+        return ConstDataBlock{encoded};
+    }
+    std::size_t size() const { return bytes().size(); }
+
+    // true if the kept encoding is up to date, so bytes() will not encode
+    bool cached() const { return valid; }
+
+    bool operator==(const Cached& other) const { return obj == other.obj; }
+};
+
+// as EmbeddedSize and WriteEmbedded of a message, the size comes from the encoding rather than the SizeCache
+template<ProtoStruct PS>
+inline std::size_t EmbeddedSize(std::size_t tag_size, const Cached<PS>& msg, SizeCache&, bool present)
+{
+    const auto msg_size = msg.size();
+    return (msg_size || present) ? tag_size + VarintSize(msg_size) + msg_size : 0;
+}
+
+template<OutputSink S, ProtoStruct PS>
+inline void WriteEmbedded(S& tgt, const EncodedTag& tag, const Cached<PS>& msg, SizeCache&, bool present)
+{
+    const auto bytes = msg.bytes();
+    if (!bytes.empty() || present)
+    {
+        WriteTag(tgt, tag);
+        WriteAsVarint(tgt, bytes.size());
+        sink_write(tgt, bytes);
+    }
+}
+
+// the message on its own, as "tgt << obj.get()" would write it
+template<OutputSink S, ProtoStruct PS>
+inline S& operator<<(S& tgt, const Cached<PS>& obj)
+{
+    const auto bytes = obj.bytes();
+    sink_reserve(tgt, bytes.size());
+    sink_write(tgt, bytes);
+    return tgt;
+}
+
+// reads into the message, the encoding is made again when it is next written
+template<ProtoStruct PS>
+inline ParseResult operator>>(ConstDataBlock data, Cached<PS>& tgt)
+{
+    return data >> tgt.edit();
+}
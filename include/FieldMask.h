@@ -0,0 +1,147 @@
+#pragma once
+#include "protobuf.h"
+
+// Partial decoding
+// ReadFields<Keys...>(data, tgt) decodes only the fields named by Keys, every other field is stepped over by wire
+// type, so it is neither decoded nor allocated for. The rest of tgt is left as it was.
+// A key is a member pointer, or a field number of the top level message. Member pointers of an embedded message
+// type narrow that type too; an embedded message that no key names a member of is decoded in full.
+//
+//     Person person{};
+//     ReadFields<&Person::name, &Person::phones, &PhoneNumber::number>(data, person);
+//     // person.name, and the number (but not the type) of each phone
+
+template<ProtoStruct Top, auto... Keys>
+struct FieldMask
+{
+    template<class M> struct owner {};
+    template<class M, class C> struct owner<M C::*> { using type = C; };
+
+    template<class T, auto Key>
+    static constexpr bool names_member_of()
+    {
+        if constexpr (std::is_member_object_pointer_v<decltype(Key)>)
+            return std::is_same_v<typename owner<decltype(Key)>::type, T>;
+        else
+            return std::is_same_v<T, Top>;
+    }
+
+    template<class T, std::size_t I, auto Key>
+    static constexpr bool matches()
+    {
+        constexpr auto mbr = proto_member<T, I>;
+        if constexpr (std::is_same_v<decltype(Key), decltype(mbr.pointer)>)
+            return mbr.pointer == Key;
+        else if constexpr (std::is_integral_v<decltype(Key)>)
+            return std::is_same_v<T, Top> && mbr.field_num == Key;
+        else
+            return false;
+    }
+
+    // true if the mask limits which fields of T are read
+    template<class T>
+    static constexpr bool narrows = (names_member_of<T, Keys>() || ...);
+
+    // true if member I of T is read
+    template<class T, std::size_t I>
+    static constexpr bool wants = !narrows<T> || (matches<T, I, Keys>() || ...);
+};
+
+template<class Mask, ProtoStruct PS>
+ParseResult ReadMasked(ConstDataBlock data, PS& tgt);
+
+template<class Mask, ProtoStruct PS, std::size_t I>
+inline ParseResult ReadMaskedMember(ConstDataBlock data, WireType type, PS& tgt)
+{
+    auto& mbr = tgt.*(proto_member<PS, I>.pointer);
+    using T = std::remove_reference_t<decltype(mbr)>;
+    if constexpr (!Mask::template wants<PS, I>)
+        return SkipField(data, type);
+    else if constexpr (is_embedded_v<T>)
+    {
+        if constexpr (Mask::template narrows<embedded_message_t<T>>)
+        {
+            if (type != WireType::DELIMITED)
+                return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+            ConstDataBlock payload;
+            const auto res = SplitDelimited(data, payload);
+            if (!res)
+                return res;
+            const auto inner = ReadMasked<Mask>(payload, EmbeddedMessage(mbr));
+            return inner ? res : inner;
+        }
+    }
+    else if constexpr (is_non_string_container_v<T>)
+    {
+        using E = typename T::value_type;
+        if constexpr (is_embedded_v<E> && Mask::template narrows<embedded_message_t<E>>)
+        {
+            if (type != WireType::DELIMITED)
+                return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+            ConstDataBlock payload;
+            const auto res = SplitDelimited(data, payload);
+            if (!res)
+                return res;
+            E elem = NewElement(mbr);
+            const auto inner = ReadMasked<Mask>(payload, EmbeddedMessage(elem));
+            if (!inner)
+                return inner;
+            mbr.push_back(std::move(elem));
+            return res;
+        }
+    }
+    else if constexpr (is_optional_v<T>)
+    {
+        using V = typename T::value_type;
+        if constexpr (is_embedded_v<V> && Mask::template narrows<embedded_message_t<V>>)
+        {
+            if (type != WireType::DELIMITED)
+                return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+            ConstDataBlock payload;
+            const auto res = SplitDelimited(data, payload);
+            if (!res)
+                return res;
+            if (!mbr.has_value())
+                mbr.emplace();
+            const auto inner = ReadMasked<Mask>(payload, EmbeddedMessage(*mbr));
+            return inner ? res : inner;
+        }
+    }
+    return ReadMember<PS, I>(data, type, tgt);
+}
+
+template<class Mask, ProtoStruct PS>
+ParseResult ReadMasked(ConstDataBlock data, PS& tgt)
+{
+    constexpr auto count = proto_member_count<PS>;
+    while (!data.empty())
+    {
+        FieldID id;
+        WireType type;
+        const auto tag = ReadTag(data, id, type);
+        if (!tag)
+            return tag;
+        data = tag.rest();
+        const auto idx = FieldDispatch<PS>::find(id);
+        ParseResult res{data};
+        if (idx < count)
+        {
+            [&] <std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                ((idx==Is && (res = ReadMaskedMember<Mask, PS, Is>(data, type, tgt), true)) || ...);
+            }(std::make_index_sequence<count>{});
+        }
+        else
+            res = SkipField(data, type);    // not asked for, so not kept either
+        if (!res)
+            return res;
+        data = res.rest();
+    }
+    return data;
+}
+
+template<auto... Keys, ProtoStruct PS>
+inline ParseResult ReadFields(ConstDataBlock data, PS& tgt)
+{
+    return ReadMasked<FieldMask<PS, Keys...>>(data, tgt);
+}
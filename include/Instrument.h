@@ -0,0 +1,406 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include "Reflection.h"
+#include "OutputSink.h"
+#ifdef TINYPB_INSTRUMENT
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <vector>
+#endif
+
+// Instrumentation
+// Built with TINYPB_INSTRUMENT defined, every operator<< and operator>> of a message (embedded ones included) counts,
+// for its message type and for each of its fields, the calls made and the bytes encoded or decoded. It also counts
+// the allocations the call makes (buffer and string growth, new container elements) and times one call in every
+// TINYPB_INSTRUMENT_SAMPLE. Counters are kept per thread, and are only added up when a snapshot is taken.
+// Without TINYPB_INSTRUMENT the hooks below are empty and compile away.
+//
+//     const auto stats = InstrumentSnapshot();
+//     std::cout << InstrumentText(stats);      // or InstrumentJson(stats)
+
+#ifndef TINYPB_INSTRUMENT_SAMPLE
+#define TINYPB_INSTRUMENT_SAMPLE 64
+#endif
+
+#ifdef TINYPB_INSTRUMENT
+constexpr bool instrumented{true};
+
+// written only by the thread that owns it, so an add is a plain load and store, read by any thread
+class InstrumentCounter
+{
+    std::atomic<std::uint64_t> value{0};
+public:
+    void add(std::uint64_t n) { value.store(value.load(std::memory_order_relaxed)+n, std::memory_order_relaxed); }
+    std::uint64_t get() const { return value.load(std::memory_order_relaxed); }
+    void reset() { value.store(0, std::memory_order_relaxed); }
+};
+
+struct InstrumentCalls
+{
+    InstrumentCounter calls, bytes, allocations, samples, sampled_ns, max_ns;
+    std::uint32_t until_sample{0};      // owner only
+};
+
+struct InstrumentFieldCalls
+{
+    InstrumentCounter encoded, encoded_bytes, decoded, decoded_bytes;
+};
+
+// the counters of one message type on one thread
+struct InstrumentType
+{
+    const std::type_info* type;
+    std::vector<std::pair<FieldID, std::string_view>> members;
+    std::unique_ptr<InstrumentFieldCalls[]> fields;
+    InstrumentCalls encode, decode;
+    bool in_use{true};
+};
+
+// every InstrumentType ever made, they outlive their threads so nothing counted is lost
+// when a thread exits its records are handed to the next thread that counts the same types, so there are only ever
+// as many records of a type as there have been threads counting it at once
+class InstrumentRegistry
+{
+    std::mutex lock;
+    std::vector<std::unique_ptr<InstrumentType>> all;
+public:
+    static InstrumentRegistry& get()
+    {
+        static InstrumentRegistry registry;
+        return registry;
+    }
+    // a record of type no thread is using, made by make if there is none
+    template<class Make>
+    InstrumentType& acquire(const std::type_info& type, Make&& make)
+    {
+        std::lock_guard guard{lock};
+        for (auto& rec : all)
+            if (!rec->in_use && *rec->type == type)
+            {
+                rec->in_use = true;
+                return *rec;
+            }
+        all.push_back(make());
+        return *all.back();
+    }
+    void release(const std::vector<InstrumentType*>& recs)
+    {
+        std::lock_guard guard{lock};
+        for (auto* rec : recs)
+            rec->in_use = false;
+    }
+    template<class Fn>
+    void for_each(Fn&& fn)
+    {
+        std::lock_guard guard{lock};
+        for (auto& type : all)
+            fn(*type);
+    }
+};
+
+// the records in use by this thread, released when it exits
+class InstrumentThread
+{
+    std::vector<InstrumentType*> mine;
+public:
+    static InstrumentThread& get()
+    {
+        thread_local InstrumentThread thread;
+        return thread;
+    }
+    void add(InstrumentType& type) { mine.push_back(&type); }
+    ~InstrumentThread() { InstrumentRegistry::get().release(mine); }
+};
+
+template<ProtoStruct PS>
+inline InstrumentType& instrument_type()
+{
+    thread_local InstrumentType* mine = []
+    {
+        auto& thread = InstrumentThread::get();
+        auto& type = InstrumentRegistry::get().acquire(typeid(PS), []
+        {
+            auto type = std::make_unique<InstrumentType>();
+            type->type = &typeid(PS);
+            std::apply([&](const auto&... mbr) { (type->members.emplace_back(mbr.field_num, mbr.name), ...); }, PS::get_members());
+            type->fields = std::make_unique<InstrumentFieldCalls[]>(type->members.size());
+            return type;
+        });
+        thread.add(type);
+        return &type;
+    }();
+    return *mine;
+}
+
+// allocations made on this thread by the reader and writer
+inline thread_local std::uint64_t instrument_allocations{0};
+
+inline void InstrumentAllocation(bool allocates)
+{
+    instrument_allocations += allocates;
+}
+
+// one operator<< or operator>> of a message
+class InstrumentScope
+{
+    InstrumentType& type;
+    InstrumentCalls& calls;
+    std::uint64_t allocations_before{instrument_allocations};
+    bool timed{false};
+    std::chrono::steady_clock::time_point start;
+public:
+    InstrumentScope(InstrumentType& t, InstrumentCalls& c) : type(t), calls(c)
+    {
+        if (calls.until_sample-- == 0)
+        {
+            calls.until_sample = TINYPB_INSTRUMENT_SAMPLE-1;
+            timed = true;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    // records of a field that were written or read, an unwritten (default) field has no bytes and is not counted
+    void field(std::size_t idx, std::size_t bytes, std::size_t records = 1)
+    {
+        if (bytes == 0)
+            return;
+        auto& counters = type.fields[idx];
+        auto& count = (&calls == &type.encode) ? counters.encoded : counters.decoded;
+        auto& total = (&calls == &type.encode) ? counters.encoded_bytes : counters.decoded_bytes;
+        count.add(records);
+        total.add(bytes);
+    }
+    void finish(std::size_t bytes)
+    {
+        if (timed)
+        {
+            const auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now()-start).count());
+            calls.samples.add(1);
+            calls.sampled_ns.add(ns);
+            if (ns > calls.max_ns.get())
+                calls.max_ns.add(ns-calls.max_ns.get());
+        }
+        calls.calls.add(1);
+        calls.bytes.add(bytes);
+        calls.allocations.add(instrument_allocations-allocations_before);
+    }
+};
+
+template<ProtoStruct PS>
+inline InstrumentScope InstrumentEncode()
+{
+    auto& type = instrument_type<PS>();
+    return InstrumentScope{type, type.encode};
+}
+
+template<ProtoStruct PS>
+inline InstrumentScope InstrumentDecode()
+{
+    auto& type = instrument_type<PS>();
+    return InstrumentScope{type, type.decode};
+}
+
+// the scope made by make, for code that only has a pointer to InstrumentEncode<PS> or InstrumentDecode<PS>
+inline InstrumentScope InstrumentCall(InstrumentScope (*make)())
+{
+    return make();
+}
+
+// counts the bytes written to a sink that cannot tell how much it holds
+template<class S>
+class CountingSink
+{
+    S& inner;
+    std::size_t written{0};
+public:
+    explicit CountingSink(S& s) : inner(s) {}
+    void write(std::byte v) { sink_write(inner, v); ++written; }
+    void write(ConstDataBlock v) { sink_write(inner, v); written += v.size(); }
+    void reserve(std::size_t size) { sink_reserve(inner, size); }
+    std::size_t size() const { return written; }
+};
+
+// how many bytes a sink holds, the encoded size of a field is the difference
+template<class S>
+inline std::size_t InstrumentPosition(const S& tgt)
+{
+    if constexpr (requires { { tgt.size() } -> std::convertible_to<std::size_t>; })
+        return tgt.size();
+    else
+        return 0;
+}
+
+// tgt itself if it knows its size, otherwise a CountingSink around it
+template<class S>
+inline decltype(auto) InstrumentSink(S& tgt)
+{
+    if constexpr (requires { { tgt.size() } -> std::convertible_to<std::size_t>; })
+        return (tgt);
+    else
+        return CountingSink<S>{tgt};
+}
+
+// Snapshots
+struct InstrumentCallStats
+{
+    std::uint64_t calls{0}, bytes{0}, allocations{0}, samples{0}, sampled_ns{0}, max_ns{0};
+    double mean_ns() const { return samples ? static_cast<double>(sampled_ns)/samples : 0.0; }
+};
+
+struct InstrumentFieldStats
+{
+    FieldID field;
+    std::string name;
+    std::uint64_t encoded{0}, encoded_bytes{0}, decoded{0}, decoded_bytes{0};
+};
+
+struct InstrumentTypeStats
+{
+    std::string type;
+    InstrumentCallStats encode, decode;
+    std::vector<InstrumentFieldStats> fields;
+};
+
+// the counters of every thread, added up per message type
+inline std::vector<InstrumentTypeStats> InstrumentSnapshot()
+{
+    std::vector<std::pair<const std::type_info*, InstrumentTypeStats>> merged;
+    const auto add = [](InstrumentCallStats& to, const InstrumentCalls& from)
+    {
+        to.calls += from.calls.get();
+        to.bytes += from.bytes.get();
+        to.allocations += from.allocations.get();
+        to.samples += from.samples.get();
+        to.sampled_ns += from.sampled_ns.get();
+        to.max_ns = std::max(to.max_ns, from.max_ns.get());
+    };
+    InstrumentRegistry::get().for_each([&](const InstrumentType& type)
+    {
+        auto found = std::find_if(merged.begin(), merged.end(), [&](const auto& m) { return *m.first == *type.type; });
+        if (found == merged.end())
+        {
+            InstrumentTypeStats stats;
+            stats.type = type.type->name();
+            for (const auto& [field, name] : type.members)
+                stats.fields.push_back(InstrumentFieldStats{field, std::string{name}});
+            merged.emplace_back(type.type, std::move(stats));
+            found = merged.end()-1;
+        }
+        auto& stats = found->second;
+        add(stats.encode, type.encode);
+        add(stats.decode, type.decode);
+        for (std::size_t idx = 0; idx < stats.fields.size(); ++idx)
+        {
+            stats.fields[idx].encoded += type.fields[idx].encoded.get();
+            stats.fields[idx].encoded_bytes += type.fields[idx].encoded_bytes.get();
+            stats.fields[idx].decoded += type.fields[idx].decoded.get();
+            stats.fields[idx].decoded_bytes += type.fields[idx].decoded_bytes.get();
+        }
+    });
+    std::vector<InstrumentTypeStats> res;
+    for (auto& [type, stats] : merged)
+        res.push_back(std::move(stats));
+    return res;
+}
+
+// zeroes every counter, meant for when nothing is being encoded or decoded
+inline void InstrumentReset()
+{
+    InstrumentRegistry::get().for_each([](InstrumentType& type)
+    {
+        for (auto* calls : {&type.encode, &type.decode})
+            for (auto* counter : {&calls->calls, &calls->bytes, &calls->allocations, &calls->samples, &calls->sampled_ns, &calls->max_ns})
+                counter->reset();
+        for (std::size_t idx = 0; idx < type.members.size(); ++idx)
+            for (auto* counter : {&type.fields[idx].encoded, &type.fields[idx].encoded_bytes, &type.fields[idx].decoded, &type.fields[idx].decoded_bytes})
+                counter->reset();
+    });
+}
+
+inline std::string InstrumentText(const std::vector<InstrumentTypeStats>& stats)
+{
+    std::string res;
+    const auto calls = [&](const char* what, const InstrumentCallStats& c)
+    {
+        res += "  " + std::string{what} + ": " + std::to_string(c.calls) + " calls, " + std::to_string(c.bytes) +
+               " bytes, " + std::to_string(c.allocations) + " allocations, " + std::to_string(c.samples) +
+               " timed (mean " + std::to_string(static_cast<std::uint64_t>(c.mean_ns())) + " ns, max " +
+               std::to_string(c.max_ns) + " ns)\n";
+    };
+    for (const auto& type : stats)
+    {
+        res += type.type + "\n";
+        calls("encode", type.encode);
+        calls("decode", type.decode);
+        for (const auto& field : type.fields)
+            res += "  " + std::to_string(field.field) + " " + field.name + ": encoded " + std::to_string(field.encoded) +
+                   " (" + std::to_string(field.encoded_bytes) + " bytes), decoded " + std::to_string(field.decoded) +
+                   " (" + std::to_string(field.decoded_bytes) + " bytes)\n";
+    }
+    return res;
+}
+
+inline std::string InstrumentJson(const std::vector<InstrumentTypeStats>& stats)
+{
+    const auto quoted = [](std::string_view s)
+    {
+        std::string res{"\""};
+        for (char c : s)
+        {
+            if (c=='"' || c=='\\')
+                res += '\\';
+            res += c;
+        }
+        return res + "\"";
+    };
+    const auto calls = [](const InstrumentCallStats& c)
+    {
+        return "{\"calls\":" + std::to_string(c.calls) + ",\"bytes\":" + std::to_string(c.bytes) +
+               ",\"allocations\":" + std::to_string(c.allocations) + ",\"samples\":" + std::to_string(c.samples) +
+               ",\"sampled_ns\":" + std::to_string(c.sampled_ns) + ",\"max_ns\":" + std::to_string(c.max_ns) + "}";
+    };
+    std::string res{"["};
+    for (const auto& type : stats)
+    {
+        if (&type != &stats.front())
+            res += ",";
+        res += "{\"type\":" + quoted(type.type) + ",\"encode\":" + calls(type.encode) + ",\"decode\":" +
+               calls(type.decode) + ",\"fields\":[";
+        for (const auto& field : type.fields)
+        {
+            if (&field != &type.fields.front())
+                res += ",";
+            res += "{\"field\":" + std::to_string(field.field) + ",\"name\":" + quoted(field.name) +
+                   ",\"encoded\":" + std::to_string(field.encoded) + ",\"encoded_bytes\":" +
+                   std::to_string(field.encoded_bytes) + ",\"decoded\":" + std::to_string(field.decoded) +
+                   ",\"decoded_bytes\":" + std::to_string(field.decoded_bytes) + "}";
+        }
+        res += "]}";
+    }
+    return res + "]";
+}
+
+#else
+constexpr bool instrumented{false};
+
+struct InstrumentScope
+{
+    void field(std::size_t, std::size_t, std::size_t = 1) {}
+    void finish(std::size_t) {}
+};
+
+template<ProtoStruct PS> inline InstrumentScope InstrumentEncode() { return {}; }
+template<ProtoStruct PS> inline InstrumentScope InstrumentDecode() { return {}; }
+inline InstrumentScope InstrumentCall(InstrumentScope (*)()) { return {}; }
+inline void InstrumentAllocation(bool) {}
+template<class S> inline std::size_t InstrumentPosition(const S&) { return 0; }
+template<class S> inline S& InstrumentSink(S& tgt) { return tgt; }
+#endif
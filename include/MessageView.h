@@ -0,0 +1,229 @@
+#pragma once
+#include "protobuf.h"
+#include <iterator>
+
+// Read-only, lazy access to an encoded message.
+// Nothing is decoded until a field is asked for, and then only that field: the other fields are stepped
+// over by wire type, without decoding. Nothing is allocated. Strings and bytes are returned as views
+// into the buffer, embedded messages as MessageViews and repeated fields as ranges that decode an element
+// at a time. Like the borrowed fields of operator>>, every result is only valid while the buffer is.
+//
+//     MessageView<Person> person{data};
+//     std::string_view name = person.get<&Person::name>();
+//     for (MessageView<Person::PhoneNumber> phone : person.get<&Person::phones>())
+//         ...
+//
+// Fields are named by member pointer or by field number, get<1>() is the same as get<&Person::name>().
+// A view does not report malformed input: a scan stops where the bytes stop making sense, as if the message
+// ended there, and a field that arrives with a wire type its member cannot be read from makes get() return the
+// default value (or ends a repeated field's range). Parse the message to find out what is wrong with it.
+
+template<ProtoStruct PS> class MessageView;
+
+template<class T> struct field_view { using type = T; };
+template<ProtoStruct T> struct field_view<T> { using type = MessageView<T>; };
+template<CachedType T> struct field_view<T> { using type = MessageView<typename T::message_type>; };
+template<StringType T> struct field_view<T> { using type = std::string_view; };
+template<class T> struct field_view<std::optional<T>> { using type = std::optional<typename field_view<T>::type>; };
+template<class T> using field_view_t = typename field_view<T>::type;
+
+// decodes the payload of one value, borrowed strings and bytes are specialised below
+template<class T>
+inline field_view_t<T> DecodeFieldView(ConstDataBlock payload)
+{
+    if constexpr (is_embedded_v<T>)
+        return field_view_t<T>{payload};
+    else if constexpr (is_string_v<T>)
+        return std::string_view{reinterpret_cast<const char*>(payload.data()), payload.size()};
+    else
+    {
+        T value{};
+        payload >> value;
+        return value;
+    }
+}
+
+template<>
+inline std::string_view DecodeFieldView<std::string_view>(ConstDataBlock payload)
+{
+    return DecodeFieldView<std::string>(payload);
+}
+
+template<>
+inline std::span<const std::byte> DecodeFieldView<std::span<const std::byte>>(ConstDataBlock payload)
+{
+    return payload;
+}
+
+// the elements of a repeated field, found and decoded as the range is iterated
+// packed and unpacked encodings are both accepted, and may be mixed
+template<class T>
+class RepeatedView
+{
+    ConstDataBlock data;
+    FieldID id;
+public:
+    class iterator
+    {
+        ConstDataBlock rest;
+        ConstDataBlock run;     // the rest of a packed run
+        FieldID id{0};
+        field_view_t<T> current{};
+        bool done{false};
+
+        void advance()
+        {
+            if constexpr (is_packable_v<T>)
+            {
+                if (!run.empty())
+                {
+                    const auto res = run >> current;
+                    if (res)
+                    {
+                        run = res.rest();
+                        return;
+                    }
+                    run = {};   // a malformed run ends where it goes wrong
+                }
+            }
+            while (!rest.empty())
+            {
+                RawField field;
+                const auto res = ReadRawField(rest, field);
+                if (!res)
+                    break;
+                rest = res.rest();
+                if (field.id != id)
+                    continue;
+                if constexpr (is_packable_v<T>)
+                {
+                    if (field.type == WireType::DELIMITED)
+                    {
+                        run = field.payload;
+                        if (run.empty())
+                            continue;
+                        advance();
+                        return;
+                    }
+                }
+                if (field.type != OnWireType<T>())
+                    break;
+                current = DecodeFieldView<T>(field.payload);
+                return;
+            }
+            done = true;
+        }
+    public:
+        using value_type = field_view_t<T>;
+        using difference_type = std::ptrdiff_t;
+        iterator() = default;
+        iterator(ConstDataBlock data, FieldID field_id) : rest(data), id(field_id) { advance(); }
+        const value_type& operator*() const { return current; }
+        iterator& operator++() { advance(); return *this; }
+        iterator operator++(int) { auto tmp = *this; advance(); return tmp; }
+        bool operator==(std::default_sentinel_t) const { return done; }
+    };
+
+    RepeatedView(ConstDataBlock d, FieldID field_id) : data(d), id(field_id) {}
+    iterator begin() const { return iterator{data, id}; }
+    std::default_sentinel_t end() const { return {}; }
+    bool empty() const { return begin()==end(); }
+    // counts by scanning the message
+    std::size_t size() const
+    {
+        std::size_t count{0};
+        for (auto it = begin(); it != end(); ++it)
+            ++count;
+        return count;
+    }
+};
+
+template<ProtoStruct PS>
+class MessageView
+{
+    ConstDataBlock data;
+
+    static constexpr std::size_t count = proto_member_count<PS>;
+
+    template<std::size_t I, auto Key>
+    static constexpr bool matches()
+    {
+        constexpr auto mbr = proto_member<PS, I>;
+        if constexpr (std::is_same_v<decltype(Key), decltype(mbr.pointer)>)
+            return mbr.pointer == Key;
+        else if constexpr (std::is_integral_v<decltype(Key)>)
+            return mbr.field_num == Key;
+        else
+            return false;
+    }
+
+    template<auto Key>
+    static constexpr std::size_t index_of()
+    {
+        return [] <std::size_t... Is>(std::index_sequence<Is...>)
+        {
+            std::size_t found = count;
+            ((found==count && matches<Is, Key>() ? (found = Is, true) : false), ...);
+            return found;
+        }(std::make_index_sequence<count>{});
+    }
+
+    template<auto Key>
+    using member_type = std::remove_cvref_t<decltype(std::declval<PS&>().*(proto_member<PS, index_of<Key>()>.pointer))>;
+
+public:
+    MessageView() = default;
+    explicit MessageView(ConstDataBlock d) : data(d) {}
+    ConstDataBlock bytes() const { return data; }
+
+    // true if the field appears in the message (for a repeated field, at least once)
+    template<auto Key>
+    bool has() const
+    {
+        static_assert(index_of<Key>() < count, "not a member of this message");
+        constexpr FieldID id = proto_member<PS, index_of<Key>()>.field_num;
+        for (auto rest = data; !rest.empty();)
+        {
+            RawField field;
+            const auto res = ReadRawField(rest, field);
+            if (!res)
+                break;
+            rest = res.rest();
+            if (field.id == id)
+                return true;
+        }
+        return false;
+    }
+
+    // the value of the field, or the default value if it is absent (an empty std::optional for an optional field)
+    // for a repeated field, a RepeatedView over its elements
+    template<auto Key>
+    auto get() const
+    {
+        static_assert(index_of<Key>() < count, "not a member of this message");
+        constexpr FieldID id = proto_member<PS, index_of<Key>()>.field_num;
+        using T = member_type<Key>;
+        if constexpr (is_non_string_container_v<T>)
+            return RepeatedView<typename T::value_type>{data, id};
+        else
+        {
+            // the last occurrence wins, as it does in a full parse
+            // (an embedded message that appears more than once is not merged)
+            using V = optional_value_t<T>;
+            field_view_t<T> value{};
+            for (auto rest = data; !rest.empty();)
+            {
+                RawField field;
+                const auto res = ReadRawField(rest, field);
+                if (!res)
+                    break;
+                rest = res.rest();
+                if (field.id == id && field.type != OnWireType<V>())
+                    return field_view_t<T>{};
+                if (field.id == id)
+                    value = DecodeFieldView<V>(field.payload);
+            }
+            return value;
+        }
+    }
+};
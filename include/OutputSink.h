@@ -0,0 +1,183 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <span>
+#include <array>
+#include <cstring>
+#include <ostream>
+#include <cerrno>
+#include <unistd.h>
+
+// data types
+using DataBlock = std::vector<std::byte>;
+using ConstDataBlock = std::span<const std::byte>;
+inline ConstDataBlock as_const(const DataBlock& v) {return ConstDataBlock{v}; }
+
+// rules for sinks
+// A sink takes bytes one at a time or in bulk. sink_reserve is a hint of how many bytes are about to be written.
+// Sink classes provide write(std::byte), write(ConstDataBlock) and reserve(std::size_t) members, a DataBlock is
+// adapted by the overloads below.
+
+inline void sink_write(DataBlock& tgt, std::byte v)
+{
+    tgt.push_back(v);
+}
+
+inline void sink_write(DataBlock& tgt, ConstDataBlock v)
+{
+    tgt.insert(tgt.end(), v.begin(), v.end());
+}
+
+// grows geometrically, reserving exactly what is needed would reallocate on every append to a non-empty block
+inline void sink_reserve(DataBlock& tgt, std::size_t size)
+{
+    if (tgt.size()+size > tgt.capacity())
+        tgt.reserve(std::max(2*tgt.capacity(), tgt.size()+size));
+}
+
+template<class S> requires requires(S& s, std::byte b) { s.write(b); }
+inline void sink_write(S& tgt, std::byte v)
+{
+    tgt.write(v);
+}
+
+template<class S> requires requires(S& s, ConstDataBlock b) { s.write(b); }
+inline void sink_write(S& tgt, ConstDataBlock v)
+{
+    tgt.write(v);
+}
+
+template<class S> requires requires(S& s, std::size_t n) { s.reserve(n); }
+inline void sink_reserve(S& tgt, std::size_t size)
+{
+    tgt.reserve(size);
+}
+
+template<typename S> concept OutputSink =
+    requires(S& s, std::byte b) { sink_write(s, b); } &&
+    requires(S& s, ConstDataBlock bytes) { sink_write(s, bytes); } &&
+    requires(S& s, std::size_t n) { sink_reserve(s, n); };
+
+// writes into a caller provided buffer, never allocates
+// a write that does not fit is dropped and marks the sink as overflowed, and from then on every write is dropped,
+// so what was written is always a prefix of the output with no holes in it
+class SpanSink
+{
+    std::span<std::byte> buffer;
+    std::size_t used{0};
+    bool overflow{false};
+public:
+    explicit SpanSink(std::span<std::byte> buf) : buffer(buf) {}
+    void write(std::byte v)
+    {
+        if (overflow || used==buffer.size())
+        {
+            overflow = true;
+            return;
+        }
+        buffer[used++] = v;
+    }
+    void write(ConstDataBlock v)
+    {
+        if (v.empty())  // may have no data pointer, which memcpy does not accept
+            return;
+        if (overflow || v.size() > buffer.size()-used)
+        {
+            overflow = true;
+            return;
+        }
+        std::memcpy(buffer.data()+used, v.data(), v.size());
+        used += v.size();
+    }
+    void reserve(std::size_t size)
+    {
+        if (size > buffer.size()-used)
+            overflow = true;
+    }
+    bool overflowed() const { return overflow; }
+    std::size_t size() const { return used; }
+    ConstDataBlock written() const { return ConstDataBlock{buffer.data(), used}; }
+};
+
+// collects writes in a fixed staging buffer and passes them to Derived::write_through in blocks
+// writes larger than the staging buffer bypass it
+template<class Derived, std::size_t N>
+class StagedSink
+{
+    std::array<std::byte, N> staging;
+    std::size_t used{0};
+    void pass_through(ConstDataBlock v) { static_cast<Derived*>(this)->write_through(v); }
+public:
+    void write(std::byte v)
+    {
+        if (used==N)
+            flush();
+        staging[used++] = v;
+    }
+    void write(ConstDataBlock v)
+    {
+        if (v.empty())
+            return;
+        if (v.size() > N-used)
+        {
+            flush();
+            if (v.size() >= N)
+            {
+                pass_through(v);
+                return;
+            }
+        }
+        std::memcpy(staging.data()+used, v.data(), v.size());
+        used += v.size();
+    }
+    void reserve(std::size_t) {}
+    void flush()
+    {
+        if (used)
+            pass_through(ConstDataBlock{staging.data(), used});
+        used = 0;
+    }
+};
+
+template<std::size_t N = 4096>
+class StreamSink : public StagedSink<StreamSink<N>, N>
+{
+    std::ostream& os;
+public:
+    explicit StreamSink(std::ostream& o) : os(o) {}
+    StreamSink(const StreamSink&) = delete;
+    ~StreamSink() { this->flush(); }
+    void write_through(ConstDataBlock v)
+    {
+        os.write(reinterpret_cast<const char*>(v.data()), static_cast<std::streamsize>(v.size()));
+    }
+};
+
+// writes to a file descriptor, the descriptor is not owned
+template<std::size_t N = 4096>
+class FdSink : public StagedSink<FdSink<N>, N>
+{
+    int fd;
+    bool failed{false};
+public:
+    explicit FdSink(int f) : fd(f) {}
+    FdSink(const FdSink&) = delete;
+    ~FdSink() { this->flush(); }
+    bool ok() const { return !failed; }
+    void write_through(ConstDataBlock v)
+    {
+        while (!v.empty() && !failed)
+        {
+            const auto res = ::write(fd, v.data(), v.size());
+            if (res < 0)
+                failed = (errno != EINTR);
+            else
+                v = v.subspan(static_cast<std::size_t>(res));
+        }
+    }
+};
+
+static_assert(OutputSink<DataBlock>);
+static_assert(OutputSink<SpanSink>);
+static_assert(OutputSink<StreamSink<>>);
+static_assert(OutputSink<FdSink<>>);
@@ -0,0 +1,296 @@
+#pragma once
+#include "protobuf.h"
+#include "ThreadPool.h"
+
+// Parallel decoding and encoding
+// Most of a large message is usually one repeated field of embedded messages (the people of an AddressBook). A
+// scan of the top level finds the bytes of each element without decoding them, then the elements are decoded on
+// a ThreadPool, each straight into its own slot of the (resized) container. The other fields are decoded by the
+// scan as usual. The result is the same as "data >> tgt".
+//
+//     ThreadPool pool;
+//     AddressBook book{};
+//     ParallelRead(data, book, pool);
+//
+// Encoding works the same way round: the elements are sized in parallel, the sizes give each element its offset,
+// and the elements are encoded in parallel, each into its own part of one buffer. The bytes are the same as
+// "tgt << obj". A DataBlock cannot grow without value initialising what it adds, so the buffer is zeroed (one
+// serial memset over the whole output) before the encode overwrites it; that pass is cheap next to encoding, but
+// it is not free.
+//
+// The error returned is the first in the input, as "data >> tgt" would report it. The scan stops at a malformed
+// top level field, but every element it found before then is decoded, including those after a malformed element.
+// The elements of a std::pmr container are decoded on the calling thread, as its memory resource may not be thread
+// safe.
+
+// a top level member decoded in parallel: a resizable random access container of messages
+template<class T>
+constexpr bool is_parallel_member_v = [] {
+    if constexpr (is_non_string_container_v<T>)
+        return is_embedded_v<typename T::value_type> && std::ranges::random_access_range<T> &&
+               requires(T& t) { t.resize(std::size_t{}); };
+    else
+        return false;
+}();
+
+template<ProtoStruct PS>
+ParseResult ParallelRead(ConstDataBlock data, PS& tgt, ThreadPool& pool)
+{
+    constexpr auto count = proto_member_count<PS>;
+    constexpr auto parallel = [] <std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        using Members = std::tuple<std::remove_cvref_t<decltype(std::declval<PS&>().*(proto_member<PS, Is>.pointer))>...>;
+        return std::array<bool, count>{ is_parallel_member_v<std::tuple_element_t<Is, Members>>... };
+    }(std::make_index_sequence<count>{});
+
+    // the scan, the payload of every element of a parallel member is kept for later
+    const auto input = data;
+    std::array<std::vector<ConstDataBlock>, count> elements;
+    ParseResult failed{data};
+    while (!data.empty())
+    {
+        const auto field_start = data;
+        FieldID id;
+        WireType type;
+        const auto tag = ReadTag(data, id, type);
+        if (!tag)
+        {
+            failed = tag;
+            break;
+        }
+        data = tag.rest();
+        const auto idx = FieldDispatch<PS>::find(id);
+        ParseResult res{data};
+        if (idx < count && parallel[idx] && type==WireType::DELIMITED)
+        {
+            ConstDataBlock payload;
+            res = SplitDelimited(data, payload);
+            if (res)
+                elements[idx].push_back(payload);
+        }
+        else if (idx < count)
+            res = ReadMemberAt(idx, data, type, tgt, std::make_index_sequence<count>{});
+        else
+            res = SkipField(data, type);
+        if (!res)
+        {
+            failed = res;
+            break;
+        }
+        data = res.rest();
+        if constexpr (KeepsUnknownFields<PS>)
+        {
+            if (idx >= count)
+                tgt.unknown_fields.append(field_start.first(field_start.size()-data.size()));
+        }
+    }
+    if (failed)
+        failed = ParseResult{data};
+
+    // the elements, appended after any already in the container, then the error that comes first in the input
+    const auto earliest = [&failed, input](const ParseResult& res)
+    {
+        if (!res && (failed || res.offset(input) < failed.offset(input)))
+            failed = res;
+    };
+    proto_visit_indexed(tgt, [&](auto& mbr, auto index)
+		{
+            using this_type = std::remove_reference_t<decltype(mbr)>;
+            if constexpr (is_parallel_member_v<this_type>)
+            {
+                const auto& payloads = elements[index];
+                if (payloads.empty())
+                    return;
+                const auto first = mbr.size();
+                mbr.resize(first+payloads.size());
+                std::vector<ParseResult> results(payloads.size());
+                if constexpr (PmrAware<this_type>)
+                {
+                    // a memory resource need not be thread safe (a monotonic_buffer_resource is not), so the
+                    // elements of a pmr container are decoded on this thread
+                    for (std::size_t elem = 0; elem < payloads.size(); ++elem)
+                    {
+                        AllocateFrom(EmbeddedMessage(mbr[first+elem]), mbr.get_allocator().resource());
+                        results[elem] = payloads[elem] >> mbr[first+elem];
+                    }
+                }
+                else
+                    pool.parallel_for(payloads.size(), [&](std::size_t elem)
+                    {
+                        results[elem] = payloads[elem] >> mbr[first+elem];
+                    });
+                std::for_each(results.begin(), results.end(), earliest);
+            }
+		});
+    return failed;
+}
+
+// appends obj to tgt
+template<ProtoStruct PS>
+DataBlock& ParallelWrite(DataBlock& tgt, const PS& obj, ThreadPool& pool)
+{
+    constexpr auto count = proto_member_count<PS>;
+    const std::size_t ranges = (pool.size()+1)*4;
+
+    // the elements of a parallel member are split into ranges, each sized with its own cache
+    struct Block
+    {
+        std::vector<SizeCache> caches;
+        std::vector<std::size_t> sizes;     // bytes written for each range
+    };
+    std::array<Block, count> blocks;
+    std::array<std::size_t, count> member_sizes{};
+    SizeCache cache;    // the other members, in order
+    const auto range_of = [](std::size_t range, std::size_t elems, std::size_t ranges)
+    {
+        return std::pair{range*elems/ranges, (range+1)*elems/ranges};
+    };
+
+    proto_visit_ordered(obj, [&](const auto& mbr, auto index)
+		{
+            using this_type = std::remove_const_t<std::remove_reference_t<decltype(mbr)>>;
+            if constexpr (is_parallel_member_v<this_type>)
+            {
+                constexpr std::size_t tag_size{member_tag<PS, index>.size};
+                auto& block = blocks[index];
+                const auto used = std::min(ranges, std::size(mbr));
+                block.caches.resize(used);
+                block.sizes.resize(used);
+                pool.parallel_for(used, [&](std::size_t range)
+                {
+                    const auto [first, last] = range_of(range, std::size(mbr), used);
+                    for (auto elem = first; elem < last; ++elem)
+                        block.sizes[range] += EmbeddedSize(tag_size, mbr[elem], block.caches[range], true);
+                });
+                member_sizes[index] = std::accumulate(block.sizes.begin(), block.sizes.end(), std::size_t{0});
+            }
+            else
+                member_sizes[index] = MemberSize<PS, index>(mbr, cache);
+		});
+
+    std::size_t total = std::accumulate(member_sizes.begin(), member_sizes.end(), std::size_t{0});
+    if constexpr (KeepsUnknownFields<PS>)
+        total += obj.unknown_fields.size();
+    auto offset = tgt.size();
+    tgt.resize(offset+total);     // zero fills, see above
+
+    proto_visit_ordered(obj, [&](const auto& mbr, auto index)
+		{
+            using this_type = std::remove_const_t<std::remove_reference_t<decltype(mbr)>>;
+            const std::span<std::byte> region{tgt.data()+offset, member_sizes[index]};
+            if constexpr (is_parallel_member_v<this_type>)
+            {
+                constexpr auto tag = member_tag<PS, index>;
+                auto& block = blocks[index];
+                std::vector<std::size_t> starts(block.sizes.size());
+                std::exclusive_scan(block.sizes.begin(), block.sizes.end(), starts.begin(), std::size_t{0});
+                pool.parallel_for(block.sizes.size(), [&](std::size_t range)
+                {
+                    SpanSink sink{region.subspan(starts[range], block.sizes[range])};
+                    const auto [first, last] = range_of(range, std::size(mbr), block.sizes.size());
+                    for (auto elem = first; elem < last; ++elem)
+                        WriteEmbedded(sink, tag, mbr[elem], block.caches[range], true);
+                    assert(!sink.overflowed() && sink.size()==block.sizes[range]);
+                });
+            }
+            else
+            {
+                SpanSink sink{region};
+                WriteMember<PS, index>(sink, mbr, cache);
+                assert(!sink.overflowed() && sink.size()==region.size());
+            }
+            offset += member_sizes[index];
+		});
+    if constexpr (KeepsUnknownFields<PS>)
+        if (!obj.unknown_fields.empty())
+            std::memcpy(tgt.data()+offset, obj.unknown_fields.data().data(), obj.unknown_fields.size());
+    return tgt;
+}
+
+
+// Batches
+// Many independent messages, encoded or decoded on a pool. Each range of messages is encoded into a buffer of its
+// own, then the buffers are joined into one, with an index of where each message starts.
+//
+//     const auto batch = encode_batch(std::span{updates});
+//     for (std::size_t idx = 0; idx < batch.size(); ++idx)
+//         send(batch[idx]);
+
+// the pool used when none is given, one worker per extra core
+inline ThreadPool& default_pool()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+struct EncodedBatch
+{
+    DataBlock bytes;
+    std::vector<std::size_t> offsets;   // message idx is bytes [offsets[idx], offsets[idx+1])
+
+    std::size_t size() const { return offsets.empty() ? 0 : offsets.size()-1; }
+    ConstDataBlock operator[](std::size_t idx) const
+    {
+        return ConstDataBlock{bytes}.subspan(offsets[idx], offsets[idx+1]-offsets[idx]);
+    }
+};
+
+template<ProtoStruct PS>
+EncodedBatch encode_batch(std::span<const PS> msgs, ThreadPool& pool = default_pool())
+{
+    EncodedBatch batch;
+    batch.offsets.resize(msgs.size()+1);
+    const auto ranges = std::min(msgs.size(), (pool.size()+1)*4);
+    std::vector<DataBlock> buffers(ranges);
+    pool.parallel_for(ranges, [&](std::size_t range)
+    {
+        const auto first = range*msgs.size()/ranges;
+        const auto last = (range+1)*msgs.size()/ranges;
+        auto& buffer = buffers[range];
+        for (auto idx = first; idx < last; ++idx)
+        {
+            buffer << msgs[idx];
+            batch.offsets[idx+1] = buffer.size();     // within the range for now
+        }
+    });
+
+    std::vector<std::size_t> starts(ranges);
+    std::size_t total{0};
+    for (std::size_t range = 0; range < ranges; ++range)
+    {
+        starts[range] = total;
+        total += buffers[range].size();
+    }
+    batch.bytes.resize(total);
+    pool.parallel_for(ranges, [&](std::size_t range)
+    {
+        const auto first = range*msgs.size()/ranges;
+        const auto last = (range+1)*msgs.size()/ranges;
+        if (!buffers[range].empty())
+            std::memcpy(batch.bytes.data()+starts[range], buffers[range].data(), buffers[range].size());
+        for (auto idx = first; idx < last; ++idx)
+            batch.offsets[idx+1] += starts[range];
+    });
+    return batch;
+}
+
+// any contiguous range of messages, a std::vector or a std::span of non-const messages say
+template<std::ranges::contiguous_range R> requires ProtoStruct<std::ranges::range_value_t<R>>
+EncodedBatch encode_batch(const R& msgs, ThreadPool& pool = default_pool())
+{
+    using PS = std::ranges::range_value_t<R>;
+    return encode_batch(std::span<const PS>{std::ranges::data(msgs), std::ranges::size(msgs)}, pool);
+}
+
+// decodes msgs[idx] into tgts[idx], as "msgs[idx] >> tgts[idx]" would, and returns what that returned
+// if the sizes differ only as many as the shorter holds are decoded, and that is how many results there are
+template<ProtoStruct PS>
+std::vector<ParseResult> decode_batch(std::span<const ConstDataBlock> msgs, std::span<PS> tgts, ThreadPool& pool = default_pool())
+{
+    std::vector<ParseResult> results(std::min(msgs.size(), tgts.size()));
+    pool.parallel_for(results.size(), [&](std::size_t idx)
+    {
+        results[idx] = msgs[idx] >> tgts[idx];
+    });
+    return results;
+}
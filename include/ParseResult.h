@@ -0,0 +1,79 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+// Parse errors
+// Every reader returns a ParseResult, which is either the input left after what was read, or what was wrong with
+// the input and where, in the manner of std::expected<ConstDataBlock, ParseError>. Readers check their input and
+// stop at the first error, nothing is asserted or thrown, and a reader of a message hands the error of an embedded
+// one back unchanged, so the offset is always that of the innermost fault. Members read before the error keep
+// what was read.
+//
+//     const auto res = ConstDataBlock{data} >> person;
+//     if (!res)
+//         log(to_string(res.error()), res.offset(data));
+//
+// On valid input the cost is one length check per field: a varint is checked for its terminating byte as part
+// of decoding it, and a fixed width or length prefixed payload against what is left of the input.
+
+enum class ParseError : std::uint8_t
+{
+    NONE,
+    TRUNCATED,          // the input ends part way through a field
+    BAD_VARINT,         // a varint that runs past 10 bytes
+    BAD_LENGTH,         // a length longer than the rest of the input, or a packed run that is not whole values
+    BAD_WIRE_TYPE,      // a wire type that is not supported (the proto2 groups, 6 and 7)
+    WRONG_WIRE_TYPE,    // a known field that arrives with a wire type its member cannot be read from
+    BAD_FIELD_NUMBER,   // a tag with field number 0, or one past the largest, 2^29-1
+};
+
+constexpr std::string_view to_string(ParseError error)
+{
+    switch (error)
+    {
+        case ParseError::NONE: return "none";
+        case ParseError::TRUNCATED: return "truncated";
+        case ParseError::BAD_VARINT: return "bad varint";
+        case ParseError::BAD_LENGTH: return "bad length";
+        case ParseError::BAD_WIRE_TYPE: return "bad wire type";
+        case ParseError::WRONG_WIRE_TYPE: return "wrong wire type";
+        case ParseError::BAD_FIELD_NUMBER: return "bad field number";
+    }
+    return "unknown";
+}
+
+// the size of what is left, or the error with the top bit set (a span is never that large)
+// two words, so a ParseResult is returned in registers, as the ConstDataBlock it replaced was
+class ParseResult
+{
+    static constexpr std::size_t failed{std::size_t{1} << (8*sizeof(std::size_t)-1)};
+    const std::byte* at{nullptr};   // where the rest, or the input from the error, starts
+    std::size_t left{0};
+
+    ParseResult(const std::byte* where, std::size_t size) : at(where), left(size) {}
+public:
+    ParseResult() = default;
+    ParseResult(std::span<const std::byte> rest) : at(rest.data()), left(rest.size()) {}
+
+    // the error found at the start of where, which is a part of the input
+    static ParseResult failure(ParseError error, std::span<const std::byte> where)
+    {
+        return ParseResult{where.data(), failed | static_cast<std::size_t>(error)};
+    }
+
+    bool has_value() const { return left < failed; }
+    explicit operator bool() const { return has_value(); }
+    ParseError error() const { return has_value() ? ParseError::NONE : static_cast<ParseError>(left & 0xFF); }
+
+    // the input left after what was read, empty if there was an error
+    std::span<const std::byte> rest() const { return {at, has_value() ? left : 0}; }
+    std::span<const std::byte> value() const { return rest(); }
+
+    // where in input the error was found (or where the rest starts), input must be what was passed to the reader
+    std::size_t offset(std::span<const std::byte> input) const
+    {
+        return static_cast<std::size_t>(at-input.data());
+    }
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include "protobuf.h"
+#include <iterator>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Streams of messages
+// A message does not record its own length, so a stream of them is framed: each record is the varint length of
+// the message followed by the message (the same framing as writeDelimitedTo/parseDelimitedFrom in Google's
+// library). Records are read straight out of the buffer, and a MappedFile makes that buffer a whole file without
+// reading it in, so a log far larger than memory can be scanned.
+//
+//     MappedFile file{"log.data"};
+//     for (ConstDataBlock record : RecordReader{file.data()})
+//     {
+//         Entry entry{};
+//         record >> entry;
+//     }
+
+// appends one record, the length of obj then obj
+template<OutputSink S, ProtoStruct PS>
+inline S& WriteDelimited(S& tgt, const PS& obj)
+{
+    SizeCache cache;
+    const auto size = ByteSize(obj, cache);
+    sink_reserve(tgt, VarintSize(size)+size);
+    WriteAsVarint(tgt, size);
+    auto&& sink = InstrumentSink(tgt);
+    WriteMessage(sink, obj, cache);
+    return tgt;
+}
+
+// splits the first record from data, returns the rest
+// if data does not start with a whole record, record is left empty and data is returned as it was
+inline ConstDataBlock NextRecord(ConstDataBlock data, ConstDataBlock& record)
+{
+    record = {};
+    std::uint64_t size;
+    const auto prefix = DecodeVarint(data.data(), data.size(), size);
+    if (!prefix || size > data.size()-prefix)
+        return data;
+    record = data.subspan(prefix, size);
+    return data.subspan(prefix+size);
+}
+
+// reads one record into tgt, returns the rest or the error
+template<ProtoStruct PS>
+inline ParseResult ReadDelimited(ConstDataBlock data, PS& tgt)
+{
+    return ReadValue(data, tgt);    // a record is framed as an embedded message is
+}
+
+// the records in a buffer, as views into it
+// iteration stops at the end of the buffer, or at a record that is cut short (as the tail of a log that is still
+// being written can be); truncated() tells them apart
+class RecordReader
+{
+    ConstDataBlock data;
+public:
+    class iterator
+    {
+        ConstDataBlock rest;
+        ConstDataBlock current;
+        bool done{false};
+        void advance()
+        {
+            const auto next = NextRecord(rest, current);
+            done = next.size()==rest.size();
+            rest = next;
+        }
+    public:
+        using value_type = ConstDataBlock;
+        using difference_type = std::ptrdiff_t;
+        iterator() = default;
+        explicit iterator(ConstDataBlock d) : rest(d) { advance(); }
+        const value_type& operator*() const { return current; }
+        iterator& operator++() { advance(); return *this; }
+        iterator operator++(int) { auto tmp = *this; advance(); return tmp; }
+        bool operator==(std::default_sentinel_t) const { return done; }
+    };
+
+    explicit RecordReader(ConstDataBlock d) : data(d) {}
+    iterator begin() const { return iterator{data}; }
+    std::default_sentinel_t end() const { return {}; }
+
+    // true if the buffer ends part way through a record
+    bool truncated() const
+    {
+        auto rest = data;
+        for (ConstDataBlock record; !rest.empty();)
+        {
+            const auto next = NextRecord(rest, record);
+            if (next.size()==rest.size())
+                return true;
+            rest = next;
+        }
+        return false;
+    }
+};
+
+// a read-only view of a whole file, mapped into memory (POSIX)
+class MappedFile
+{
+    const std::byte* base{nullptr};
+    std::size_t length{0};
+    bool failed{false};
+public:
+    explicit MappedFile(const char* name)
+    {
+        const int fd = ::open(name, O_RDONLY);
+        struct stat info;
+        if (fd < 0 || ::fstat(fd, &info) != 0)
+            failed = true;
+        else if (info.st_size > 0)
+        {
+            length = static_cast<std::size_t>(info.st_size);
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                failed = true;
+                length = 0;
+            }
+            else
+            {
+                base = static_cast<const std::byte*>(mapped);
+                ::madvise(mapped, length, MADV_SEQUENTIAL);   // records are read front to back
+            }
+        }
+        if (fd >= 0)
+            ::close(fd);    // the mapping keeps the file open
+    }
+    explicit MappedFile(const std::string& name) : MappedFile(name.c_str()) {}
+    MappedFile(MappedFile&& other) : base(other.base), length(other.length), failed(other.failed)
+    {
+        other.base = nullptr;
+        other.length = 0;
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile()
+    {
+        if (base)
+            ::munmap(const_cast<std::byte*>(base), length);
+    }
+    bool ok() const { return !failed; }
+    ConstDataBlock data() const { return ConstDataBlock{base, length}; }
+    std::size_t size() const { return length; }
+};
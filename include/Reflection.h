@@ -2,6 +2,7 @@
 #include <tuple>
 #include <utility>
 #include <string_view>
+#include <type_traits>
 class ObjectStart{};
 class ObjectEnd{};
 
@@ -202,6 +203,20 @@ inline void proto_visit(PS& obj, Fn&& fn)
 };
 
 
+// as proto_visit, but passes the member position as a std::integral_constant, so per-member
+// constants can be computed at compile time
+template <ProtoStruct PS, typename Fn>
+inline void proto_visit_indexed(PS& obj, Fn&& fn)
+{
+	const auto mbrs = PS::get_members();
+
+	const auto call_fn = [&]<std::size_t...Is>(std::index_sequence<Is...>)
+	{
+		(fn(obj.*std::get<Is>(mbrs).pointer, std::integral_constant<std::size_t, Is>{}), ...);
+	};
+	call_fn(std::make_index_sequence<std::tuple_size_v<decltype(mbrs)>>{});
+};
+
 template <ProtoStruct PS, typename Fn>
 inline void proto_enumerate_recursive(PS& obj, Fn&& fn)
 {
@@ -246,6 +261,10 @@ inline void proto_enumerate(PS& obj, Fn&& fn)
 	std::apply(call_fn, mbrs);
 };
 
+// compile time access to the members of a ProtoStruct, by position in get_members()
+template<class PS> constexpr std::size_t proto_member_count = std::tuple_size_v<decltype(std::remove_cvref_t<PS>::get_members())>;
+template<class PS, std::size_t I> constexpr auto proto_member = std::get<I>(std::remove_cvref_t<PS>::get_members());
+
 template<class T> struct is_proto_struct;
 template<ProtoStruct T> struct is_proto_struct<T> : public std::true_type {};
 template<NotProtoStruct T> struct is_proto_struct<T> : public std::false_type {};
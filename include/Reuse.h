@@ -0,0 +1,192 @@
+#pragma once
+#include "protobuf.h"
+
+// Parsing into a reused object
+// ReadReusing(data, tgt) leaves tgt as "tgt = PS{}; data >> tgt;" would, but keeps what it can of the old value:
+// strings and containers keep their capacity, and the elements of a repeated string or message field are
+// overwritten in place (recursively, so their own strings and containers are kept too), as is an optional string
+// or message that is present again. Elements beyond the new count are destroyed, so a field that shrinks and grows
+// again allocates the regrown elements afresh. A Cached message is reused as the message it holds. Decoding a
+// stream of similar messages into one object this way soon stops allocating.
+//
+//     Entry entry;
+//     for (ConstDataBlock record : RecordReader{file.data()})
+//         ReadReusing(record, entry);
+
+// empties obj, keeping the capacity of its strings and containers
+template<ProtoStruct PS>
+inline void ClearKeepingCapacity(PS& obj)
+{
+    proto_visit_indexed(obj, [](auto& mbr, auto)
+		{
+            using this_type = std::remove_reference_t<decltype(mbr)>;
+            if constexpr (is_embedded_v<this_type>)
+                ClearKeepingCapacity(EmbeddedMessage(mbr));
+            else if constexpr (is_non_string_container_v<this_type> || is_string_v<this_type>)
+                mbr.clear();
+            else
+                mbr = this_type{};
+		});
+    if constexpr (KeepsUnknownFields<PS>)
+        obj.unknown_fields.clear();
+}
+
+// a repeated field whose elements are overwritten in place
+template<class T>
+constexpr bool is_reused_container_v = [] {
+    if constexpr (is_non_string_container_v<T>)
+        return (is_embedded_v<typename T::value_type> || is_string_v<typename T::value_type>) &&
+               std::ranges::random_access_range<T>;
+    else
+        return false;
+}();
+
+template<ProtoStruct PS>
+ParseResult ReadReusing(ConstDataBlock data, PS& tgt);
+
+// an embedded message read over its old value
+template<ProtoStruct PS>
+inline ParseResult ReadEmbeddedReusing(ConstDataBlock data, WireType type, PS& tgt)
+{
+    if (type != WireType::DELIMITED)
+        return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+    ConstDataBlock payload;
+    const auto res = SplitDelimited(data, payload);
+    if (!res)
+        return res;
+    const auto inner = ReadReusing(payload, tgt);
+    return inner ? res : inner;
+}
+
+template<ProtoStruct PS, std::size_t I>
+inline ParseResult ReadMemberReusing(ConstDataBlock data, WireType type, PS& tgt, std::size_t& used, bool& seen)
+{
+    auto& mbr = tgt.*(proto_member<PS, I>.pointer);
+    using T = std::remove_reference_t<decltype(mbr)>;
+    if constexpr (is_reused_container_v<T>)
+    {
+        if (used++ == std::size(mbr))
+            return ReadMember<PS, I>(data, type, tgt);
+        auto& elem = mbr[used-1];
+        if constexpr (is_embedded_v<typename T::value_type>)
+            return ReadEmbeddedReusing(data, type, EmbeddedMessage(elem));
+        else
+        {
+            if (type != WireType::DELIMITED)
+                return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+            return data >> elem;    // assigned, keeping the capacity
+        }
+    }
+    else if constexpr (is_embedded_v<T>)
+    {
+        if (seen)   // a second occurrence is merged, as usual
+            return ReadMember<PS, I>(data, type, tgt);
+        seen = true;
+        return ReadEmbeddedReusing(data, type, EmbeddedMessage(mbr));
+    }
+    else if constexpr (is_optional_v<T>)
+    {
+        // a value kept from the last message is read over, one that is not seen again is reset at the end
+        const bool first = !seen;
+        seen = true;
+        if constexpr (is_embedded_v<typename T::value_type>)
+        {
+            if (first && mbr.has_value())
+                return ReadEmbeddedReusing(data, type, EmbeddedMessage(*mbr));
+        }
+        return ReadMember<PS, I>(data, type, tgt);
+    }
+    else
+        return ReadMember<PS, I>(data, type, tgt);
+}
+
+template<ProtoStruct PS>
+ParseResult ReadReusing(ConstDataBlock data, PS& tgt)
+{
+    constexpr auto count = proto_member_count<PS>;
+    // elements of reused containers taken so far, and which embedded messages have been seen
+    std::array<std::size_t, count> used{};
+    std::array<bool, count> seen{};
+    proto_visit_indexed(tgt, [](auto& mbr, auto)
+		{
+            using this_type = std::remove_reference_t<decltype(mbr)>;
+            if constexpr (is_non_string_container_v<this_type>)
+            {
+                if constexpr (!is_reused_container_v<this_type>)
+                    mbr.clear();
+            }
+            else if constexpr (is_string_v<this_type>)
+                mbr.clear();
+            else if constexpr (is_optional_v<this_type>)
+            {
+                // kept engaged, so a string keeps its capacity, and reset at the end if the message does not have it
+                using V = typename this_type::value_type;
+                if constexpr (is_string_v<V> || is_non_string_container_v<V>)
+                {
+                    if (mbr.has_value())
+                        mbr->clear();
+                }
+                else if constexpr (!is_embedded_v<V>)
+                {
+                    if (mbr.has_value())
+                        *mbr = V{};
+                }
+            }
+            else if constexpr (!is_embedded_v<this_type>)
+                mbr = this_type{};
+		});
+    if constexpr (KeepsUnknownFields<PS>)
+        tgt.unknown_fields.clear();
+
+    ParseResult res{data};
+    while (!data.empty())
+    {
+        const auto field_start = data;
+        FieldID id;
+        WireType type;
+        res = ReadTag(data, id, type);
+        if (!res)
+            break;
+        data = res.rest();
+        const auto idx = FieldDispatch<PS>::find(id);
+        if (idx < count)
+        {
+            [&] <std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                ((idx==Is && (res = ReadMemberReusing<PS, Is>(data, type, tgt, used[Is], seen[Is]), true)) || ...);
+            }(std::make_index_sequence<count>{});
+        }
+        else
+            res = SkipField(data, type);
+        if (!res)
+            break;
+        data = res.rest();
+        if constexpr (KeepsUnknownFields<PS>)
+        {
+            if (idx >= count)
+                tgt.unknown_fields.append(field_start.first(field_start.size()-data.size()));
+        }
+    }
+
+    // what the message did not overwrite, also after an error so that nothing stale is left
+    proto_visit_indexed(tgt, [&used, &seen](auto& mbr, auto index)
+		{
+            using this_type = std::remove_reference_t<decltype(mbr)>;
+            if constexpr (is_reused_container_v<this_type>)
+            {
+                if (used[index] < std::size(mbr))
+                    mbr.erase(std::begin(mbr)+used[index], std::end(mbr));
+            }
+            else if constexpr (is_embedded_v<this_type>)
+            {
+                if (!seen[index])
+                    ClearKeepingCapacity(EmbeddedMessage(mbr));
+            }
+            else if constexpr (is_optional_v<this_type>)
+            {
+                if (!seen[index])
+                    mbr.reset();
+            }
+		});
+    return res;
+}
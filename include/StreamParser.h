@@ -0,0 +1,448 @@
+#pragma once
+#include "protobuf.h"
+
+// Incremental parsing
+// A StreamParser decodes a message from a sequence of chunks, such as the reads from a socket. A chunk may end
+// anywhere, including part way through a tag, a varint or a string. Only a field that straddles two chunks is
+// buffered, and never an embedded message or a string: an embedded message is parsed in place as its bytes arrive,
+// and the bytes of a string are appended to it directly. A scalar field entirely inside one chunk is decoded from
+// the chunk.
+//
+//     Person person;
+//     StreamParser parser{person};
+//     while (parser.status() == ParseStatus::NEED_MORE && (chunk = receive()).size())
+//         parser.feed(chunk);
+//     parser.finish();
+//
+// A message has no end marker of its own, so either give the parser the size of the message, when it is DONE as
+// soon as that many bytes have been fed, or call finish() at the end of the input. With a known size, feed() stops
+// at the end of the message, and consumed() tells where in the chunk the bytes that follow it start.
+// Messages with borrowed (string_view/span) fields cannot be parsed this way, as a chunk does not outlive feed().
+
+enum class ParseStatus { NEED_MORE, DONE, ERROR };
+
+struct StreamFrameOps;
+
+// what to do with the payload of a field, once its tag is known
+struct StreamFieldAction
+{
+    enum Kind { VALUE, SKIP, MESSAGE, STRING, ERROR } kind{SKIP};
+    std::size_t index{0};                   // VALUE: the member position
+    void* target{nullptr};                  // MESSAGE: the embedded object, STRING: the string
+    const StreamFrameOps* ops{nullptr};     // MESSAGE: how to parse the embedded object
+    void (*append)(void* target, ConstDataBlock bytes){nullptr};    // STRING: adds bytes to the string
+};
+
+template<StringType S>
+inline void StreamAppend(void* target, ConstDataBlock bytes)
+{
+    static_cast<S*>(target)->append(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+}
+
+// the type erased parts of a StreamParser, one set per message type
+struct StreamFrameOps
+{
+    StreamFieldAction (*start)(void* obj, FieldID id, WireType type);
+    bool (*read)(void* obj, std::size_t index, WireType type, ConstDataBlock payload);
+    void (*keep_unknown)(void* obj, ConstDataBlock field);
+};
+
+template<ProtoStruct PS>
+struct StreamOps
+{
+    static constexpr std::size_t count = proto_member_count<PS>;
+
+    template<std::size_t I>
+    static void start_member(PS& tgt, WireType type, StreamFieldAction& action);
+
+    static StreamFieldAction start(void* obj, FieldID id, WireType type)
+    {
+        StreamFieldAction action;
+        const auto idx = FieldDispatch<PS>::find(id);
+        if (idx < count)
+        {
+            auto& tgt = *static_cast<PS*>(obj);
+            [&] <std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                ((idx==Is && (start_member<Is>(tgt, type, action), true)) || ...);
+            }(std::make_index_sequence<count>{});
+        }
+        return action;
+    }
+
+    static bool read(void* obj, std::size_t index, WireType type, ConstDataBlock payload)
+    {
+        const auto res = ReadMemberAt(index, payload, type, *static_cast<PS*>(obj), std::make_index_sequence<count>{});
+        return res && res.rest().empty();
+    }
+
+    static void keep_unknown(void* obj, ConstDataBlock field)
+    {
+        if constexpr (KeepsUnknownFields<PS>)
+            static_cast<PS*>(obj)->unknown_fields.append(field);
+    }
+};
+
+template<ProtoStruct PS>
+constexpr StreamFrameOps stream_ops{&StreamOps<PS>::start, &StreamOps<PS>::read,
+                                    KeepsUnknownFields<PS> ? &StreamOps<PS>::keep_unknown : nullptr};
+
+template<ProtoStruct PS>
+template<std::size_t I>
+void StreamOps<PS>::start_member(PS& tgt, WireType type, StreamFieldAction& action)
+{
+    auto& mbr = tgt.*(proto_member<PS, I>.pointer);
+    using T = std::remove_reference_t<decltype(mbr)>;
+    action = StreamFieldAction{StreamFieldAction::VALUE, I};
+    if constexpr (is_embedded_v<T>)
+    {
+        // a Cached is parsed into its message, which drops the kept encoding
+        if (type == WireType::DELIMITED)
+            action = StreamFieldAction{StreamFieldAction::MESSAGE, I, &EmbeddedMessage(mbr), &stream_ops<embedded_message_t<T>>};
+        else
+            action.kind = StreamFieldAction::ERROR;
+    }
+    else if constexpr (is_optional_v<T>)
+    {
+        // strings and messages are read in place, as for members without presence
+        using V = typename T::value_type;
+        if constexpr (is_embedded_v<V> || is_string_v<V>)
+        {
+            if (type == WireType::DELIMITED)
+            {
+                if (!mbr.has_value())
+                    mbr.emplace();
+                if constexpr (is_embedded_v<V>)
+                    action = StreamFieldAction{StreamFieldAction::MESSAGE, I, &EmbeddedMessage(*mbr), &stream_ops<embedded_message_t<V>>};
+                else
+                {
+                    mbr->clear();
+                    action = StreamFieldAction{StreamFieldAction::STRING, I, &*mbr, nullptr, &StreamAppend<V>};
+                }
+            }
+            else
+                action.kind = StreamFieldAction::ERROR;
+        }
+    }
+    else if constexpr (is_string_v<T>)
+    {
+        if (type == WireType::DELIMITED)
+        {
+            mbr.clear();
+            action = StreamFieldAction{StreamFieldAction::STRING, I, &mbr, nullptr, &StreamAppend<T>};
+        }
+        else
+            action.kind = StreamFieldAction::ERROR;
+    }
+    else if constexpr (is_non_string_container_v<T>)
+    {
+        using E = typename T::value_type;
+        if constexpr (is_embedded_v<E> || is_string_v<E>)
+        {
+            if (type == WireType::DELIMITED)
+            {
+                mbr.push_back(NewElement(mbr));
+                auto& elem = *std::prev(std::end(mbr));
+                if constexpr (is_embedded_v<E>)
+                    action = StreamFieldAction{StreamFieldAction::MESSAGE, I, &EmbeddedMessage(elem), &stream_ops<embedded_message_t<E>>};
+                else
+                    action = StreamFieldAction{StreamFieldAction::STRING, I, &elem, nullptr, &StreamAppend<E>};
+            }
+            else
+                action.kind = StreamFieldAction::ERROR;
+        }
+    }
+}
+
+template<ProtoStruct PS>
+class StreamParser
+{
+    static_assert(!borrows_input<PS>(), "borrowed fields would point into a chunk that is gone after feed()");
+
+    struct Frame
+    {
+        void* obj;
+        const StreamFrameOps* ops;
+        std::size_t remaining;
+        bool bounded;
+    };
+    enum class State { TAG, LENGTH, VARINT_PAYLOAD, BYTES_PAYLOAD, STRING_BYTES };
+
+    std::vector<Frame> frames;
+    State state{State::TAG};
+    ParseStatus current{ParseStatus::NEED_MORE};
+    StreamFieldAction action;
+    WireType type{WireType::VARINT};
+    std::array<std::byte, 10> varint;
+    std::size_t varint_size{0};
+    std::array<std::byte, 10> tag;
+    std::size_t tag_size{0};
+    DataBlock pending;              // a field that straddles chunks, as ReadMember expects it
+    std::size_t need{0};            // bytes still to come in BYTES_PAYLOAD and STRING_BYTES
+    bool push_frame{false};
+    std::size_t push_size{0};
+    std::size_t taken{0};           // bytes of the chunk consumed by the last feed()
+
+    bool keeping() const { return action.kind==StreamFieldAction::SKIP && frames.back().ops->keep_unknown; }
+    bool collecting() const { return action.kind==StreamFieldAction::VALUE || keeping(); }
+
+    // appends bytes to the varint being read, true once it is complete
+    bool take_varint(ConstDataBlock avail, std::size_t& used, std::uint64_t& value)
+    {
+        while (used < avail.size())
+        {
+            const auto next = avail[used++];
+            varint[varint_size++] = next;
+            if ((next&std::byte{0x80})==std::byte{0})
+            {
+                DecodeVarint(varint.data(), varint_size, value);
+                return true;
+            }
+            if (varint_size==varint.size())
+            {
+                current = ParseStatus::ERROR;
+                return false;
+            }
+        }
+        return false;
+    }
+
+    static constexpr std::size_t bad_payload{~std::size_t{0}};
+
+    // the size of a VALUE payload, if all of it is in avail, otherwise 0, or bad_payload for a varint that is too long
+    static std::size_t complete_payload(ConstDataBlock avail, WireType type)
+    {
+        switch (type)
+        {
+            case WireType::VARINT:
+            {
+                const auto limit = avail.begin()+std::min<std::size_t>(avail.size(), 10);
+                const auto end = std::find_if(avail.begin(), limit,
+                                    [](std::byte b) { return (b&std::byte{0x80})==std::byte{0}; });
+                if (end==limit)
+                    return limit==avail.end() ? 0 : bad_payload;
+                return static_cast<std::size_t>(end-avail.begin())+1;
+            }
+            case WireType::FIXED32:
+                return avail.size() >= 4 ? 4 : 0;
+            case WireType::FIXED64:
+                return avail.size() >= 8 ? 8 : 0;
+            case WireType::DELIMITED:
+            {
+                std::uint64_t length;
+                const auto prefix = complete_payload(avail, WireType::VARINT);
+                if (!prefix || prefix==bad_payload)
+                    return prefix;
+                DecodeVarint(avail.data(), prefix, length);
+                return (length <= avail.size()-prefix) ? prefix+length : 0;
+            }
+        }
+        return 0;
+    }
+
+    void finish_field()
+    {
+        const auto& frame = frames.back();
+        if (action.kind==StreamFieldAction::VALUE && !frame.ops->read(frame.obj, action.index, type, ConstDataBlock{pending}))
+            current = ParseStatus::ERROR;
+        else if (keeping())
+            frame.ops->keep_unknown(frame.obj, ConstDataBlock{pending});
+        state = State::TAG;
+    }
+
+    void start_bytes(std::size_t size)
+    {
+        need = size;
+        state = State::BYTES_PAYLOAD;
+        if (!need)
+            finish_field();
+    }
+
+    // consumes bytes from avail, which is limited to the current message, and returns how many
+    std::size_t step(ConstDataBlock avail)
+    {
+        std::size_t used{0};
+        std::uint64_t value;
+        switch (state)
+        {
+            case State::TAG:
+            {
+                if (!take_varint(avail, used, value))
+                    return used;
+                std::copy_n(varint.begin(), varint_size, tag.begin());
+                tag_size = varint_size;
+                varint_size = 0;
+                type = static_cast<WireType>(value&7);
+                if (!ValidFieldNumber(value >> 3) ||
+                    (type!=WireType::VARINT && type!=WireType::FIXED32 && type!=WireType::FIXED64 && type!=WireType::DELIMITED))
+                {
+                    current = ParseStatus::ERROR;
+                    return used;
+                }
+                const auto& frame = frames.back();
+                action = frame.ops->start(frame.obj, static_cast<FieldID>(value >> 3), type);
+                if (action.kind==StreamFieldAction::ERROR)
+                {
+                    current = ParseStatus::ERROR;   // a string or message member with another wire type
+                    return used;
+                }
+                pending.clear();
+                if (keeping())
+                    pending.insert(pending.end(), tag.begin(), tag.begin()+tag_size);
+                if (action.kind==StreamFieldAction::VALUE)
+                {
+                    // the whole field is in this chunk, decode it from there
+                    const auto rest = avail.subspan(used);
+                    const auto size = complete_payload(rest, type);
+                    if (size==bad_payload)
+                    {
+                        current = ParseStatus::ERROR;
+                        return used;
+                    }
+                    if (size)
+                    {
+                        if (!frame.ops->read(frame.obj, action.index, type, rest.first(size)))
+                            current = ParseStatus::ERROR;
+                        return used+size;
+                    }
+                }
+                if (action.kind==StreamFieldAction::MESSAGE || action.kind==StreamFieldAction::STRING || type==WireType::DELIMITED)
+                    state = State::LENGTH;
+                else if (type==WireType::VARINT)
+                    state = State::VARINT_PAYLOAD;
+                else
+                    start_bytes(type==WireType::FIXED32 ? 4 : 8);
+                return used;
+            }
+            case State::LENGTH:
+            {
+                if (!take_varint(avail, used, value))
+                    return used;
+                if (collecting())
+                    pending.insert(pending.end(), varint.begin(), varint.begin()+varint_size);
+                varint_size = 0;
+                const auto& frame = frames.back();
+                if (frame.bounded && value > frame.remaining-used)
+                {
+                    current = ParseStatus::ERROR;
+                    return used;
+                }
+                if (action.kind==StreamFieldAction::MESSAGE)
+                {
+                    push_frame = true;
+                    push_size = value;
+                    state = State::TAG;
+                }
+                else if (action.kind==StreamFieldAction::STRING)
+                {
+                    need = value;
+                    state = need ? State::STRING_BYTES : State::TAG;
+                }
+                else
+                    start_bytes(value);
+                return used;
+            }
+            case State::VARINT_PAYLOAD:
+            {
+                const auto done = take_varint(avail, used, value);
+                if (collecting())
+                    pending.insert(pending.end(), avail.begin(), avail.begin()+used);
+                if (done)
+                {
+                    varint_size = 0;
+                    finish_field();
+                }
+                return used;
+            }
+            case State::BYTES_PAYLOAD:
+            {
+                used = std::min(need, avail.size());
+                if (collecting())
+                    pending.insert(pending.end(), avail.begin(), avail.begin()+used);
+                need -= used;
+                if (!need)
+                    finish_field();
+                return used;
+            }
+            case State::STRING_BYTES:
+            {
+                used = std::min(need, avail.size());
+                action.append(action.target, avail.first(used));
+                need -= used;
+                if (!need)
+                    state = State::TAG;
+                return used;
+            }
+        }
+        return used;
+    }
+
+    // leaves every embedded message that has been read in full
+    void settle()
+    {
+        while (current==ParseStatus::NEED_MORE && !frames.empty() && frames.back().bounded && frames.back().remaining==0)
+        {
+            if (state!=State::TAG || varint_size)
+                current = ParseStatus::ERROR;   // a field runs past the end of its message
+            else
+                frames.pop_back();
+        }
+        if (current==ParseStatus::NEED_MORE && frames.empty())
+            current = ParseStatus::DONE;
+    }
+
+public:
+    // parses a message that runs until finish() is called
+    explicit StreamParser(PS& tgt)
+    {
+        frames.reserve(8);
+        frames.push_back(Frame{&tgt, &stream_ops<PS>, 0, false});
+    }
+
+    // parses a message of a known size, DONE once that many bytes have been fed
+    StreamParser(PS& tgt, std::size_t size)
+    {
+        frames.reserve(8);
+        frames.push_back(Frame{&tgt, &stream_ops<PS>, size, true});
+        settle();
+    }
+
+    ParseStatus status() const { return current; }
+
+    // how many bytes of the chunk given to the last feed() were consumed, all of them unless it ended the message
+    // or found an error
+    std::size_t consumed() const { return taken; }
+
+    // consumes as much of chunk as belongs to the message
+    ParseStatus feed(ConstDataBlock chunk)
+    {
+        taken = 0;
+        while (!chunk.empty() && current==ParseStatus::NEED_MORE)
+        {
+            const auto top = frames.size()-1;
+            const auto avail = frames[top].bounded ? chunk.first(std::min(chunk.size(), frames[top].remaining)) : chunk;
+            const auto used = step(avail);
+            if (frames[top].bounded)
+                frames[top].remaining -= used;
+            chunk = chunk.subspan(used);
+            taken += used;
+            if (push_frame)
+            {
+                if (frames[top].bounded)
+                    frames[top].remaining -= push_size;
+                frames.push_back(Frame{action.target, action.ops, push_size, true});
+                push_frame = false;
+            }
+            settle();
+        }
+        return current;
+    }
+
+    // the end of the input, DONE if it falls between two fields of the top level message
+    ParseStatus finish()
+    {
+        if (current==ParseStatus::NEED_MORE)
+            current = (frames.size()==1 && !frames.back().bounded && state==State::TAG && !varint_size) ? ParseStatus::DONE : ParseStatus::ERROR;
+        return current;
+    }
+};
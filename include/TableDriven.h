@@ -0,0 +1,627 @@
+#pragma once
+#include "protobuf.h"
+
+// Table driven encoding and decoding
+// The operators in protobuf.h are templates, so every message type gets a reader and writer of its own, fully
+// inlined. That is the fastest code for a hot type, but with hundreds of types in one binary it is a lot of code.
+// A type that declares "static constexpr bool table_driven = true;" (or every type, when TINYPB_TABLE_DRIVEN is
+// defined as true) is instead described by a MessageTable: for each field its tag, what kind of value it holds and
+// where the member is, which one shared loop reads, sizes and writes. Only members the loop has no kind for
+// (repeated scalars, optionals, pmr strings, views...) keep their template code, reached through the table.
+// The loop is compiled once per sink type, writing to the sink directly; the template code of those members is
+// compiled once per message, for a DataBlock and for any other sink behind an ErasedSink.
+// Either way the bytes are the same, and the two kinds of type can be embedded in each other.
+//
+//     struct LogLine {
+//         static constexpr bool table_driven = true;
+//         ...
+//     };
+
+enum class FieldKind : std::uint8_t
+{
+    VARINT,     // integers and enums
+    BOOL,
+    ZIGZAG,     // SignedInt
+    FIXED,      // FixedInt of 4 or 8 bytes
+    FLOAT,
+    DOUBLE,
+    STRING,     // std::string
+    MESSAGE,    // an embedded table driven message
+    MESSAGES,   // a std::vector of them
+    OTHER       // anything else, through the member's template code
+};
+
+struct MessageTable;
+
+// any sink, behind one type, so that a member's template code can write to it without being compiled for each
+class ErasedSink
+{
+    void* sink;
+    void (*put)(void* sink, ConstDataBlock bytes);
+    void (*hint)(void* sink, std::size_t size);
+public:
+    template<OutputSink S>
+    explicit ErasedSink(S& tgt) :
+        sink(&tgt),
+        put([](void* sink, ConstDataBlock bytes) { sink_write(*static_cast<S*>(sink), bytes); }),
+        hint([](void* sink, std::size_t size) { sink_reserve(*static_cast<S*>(sink), size); })
+    {}
+    void write(std::byte v) { put(sink, ConstDataBlock{&v, 1}); }
+    void write(ConstDataBlock v) { put(sink, v); }
+    void reserve(std::size_t size) { hint(sink, size); }
+};
+
+struct FieldEntry
+{
+    EncodedTag tag;
+    FieldKind kind;
+    std::uint8_t width;             // VARINT, ZIGZAG and FIXED: bytes in the member
+    bool is_signed;                 // VARINT and ZIGZAG: the member is sign extended when it is widened
+    std::size_t offset;             // of the member in the message
+    const MessageTable& (*sub)();   // MESSAGE and MESSAGES: the embedded type
+    // MESSAGES: the vector
+    std::size_t (*count)(const void* mbr);
+    const void* (*at)(const void* mbr, std::size_t idx);
+    ParseResult (*read_element)(ConstDataBlock payload, void* mbr);    // appends the element, if it reads
+    // OTHER: ReadMember, MemberSize and WriteMember, given the whole message
+    ParseResult (*read)(ConstDataBlock data, WireType type, void* msg);
+    std::size_t (*size)(const void* msg, SizeCache& cache);
+    void (*write)(DataBlock& tgt, const void* msg, SizeCache& cache);
+    void (*write_erased)(ErasedSink& tgt, const void* msg, SizeCache& cache);
+};
+
+struct MessageTable
+{
+    std::span<const FieldEntry> fields;             // in get_members() order
+    std::span<const std::uint16_t> by_number;       // position of each field number, if they are dense
+    std::span<const std::pair<FieldID, std::uint16_t>> sorted;     // if they are not
+    std::span<const std::uint16_t> write_order;     // positions, see write_order
+    std::span<const std::uint16_t> next;            // the field expected after each, see FieldPrediction
+    std::size_t first;                              // and the field expected first
+    std::ptrdiff_t unknown_offset;                  // of an UnknownFields member, or -1
+    InstrumentScope (*encode_scope)();
+    InstrumentScope (*decode_scope)();
+
+    // position of the field with number id, or fields.size()
+    std::size_t find(FieldID id) const
+    {
+        if (!by_number.empty())
+            return (id >= 0 && static_cast<std::size_t>(id) < by_number.size()) ? by_number[id] : fields.size();
+        const auto found = std::lower_bound(sorted.begin(), sorted.end(), std::pair<FieldID, std::uint16_t>{id, 0});
+        return (found != sorted.end() && found->first == id) ? found->second : fields.size();
+    }
+};
+
+// an integer member of width bytes, widened to 64 bits as static_cast<std::uint64_t> would
+inline std::uint64_t LoadInteger(const std::byte* src, std::uint8_t width, bool is_signed)
+{
+    const auto load = [src] <class T> (T value)
+    {
+        std::memcpy(&value, src, sizeof(T));
+        return static_cast<std::uint64_t>(value);
+    };
+    switch (width)
+    {
+        case 1: return is_signed ? load(std::int8_t{}) : load(std::uint8_t{});
+        case 2: return is_signed ? load(std::int16_t{}) : load(std::uint16_t{});
+        case 4: return is_signed ? load(std::int32_t{}) : load(std::uint32_t{});
+        default: return load(std::uint64_t{});
+    }
+}
+
+// the low width bytes of value, as static_cast to the member type would keep
+inline void StoreInteger(std::byte* tgt, std::uint64_t value, std::uint8_t width)
+{
+    const auto store = [tgt] <class T> (T narrowed) { std::memcpy(tgt, &narrowed, sizeof(T)); };
+    switch (width)
+    {
+        case 1: store(static_cast<std::uint8_t>(value)); break;
+        case 2: store(static_cast<std::uint16_t>(value)); break;
+        case 4: store(static_cast<std::uint32_t>(value)); break;
+        default: store(value); break;
+    }
+}
+
+// the varint a VARINT or ZIGZAG member is written as
+inline std::uint64_t WireVarint(const FieldEntry& entry, const std::byte* mbr)
+{
+    const auto value = LoadInteger(mbr, entry.width, entry.is_signed);
+    if (entry.kind == FieldKind::VARINT)
+        return value;
+    if (entry.width <= 4)
+        return ZigZagEncode32(static_cast<std::int32_t>(value));
+    return ZigZagEncode64(static_cast<std::int64_t>(value));
+}
+
+// true if a FIXED, FLOAT or DOUBLE member holds its default, see IsDefault
+inline bool IsDefaultFixed(const FieldEntry& entry, const std::byte* mbr)
+{
+    switch (entry.kind)
+    {
+        case FieldKind::FLOAT: { float value; std::memcpy(&value, mbr, 4); return value == 0.0f; }
+        case FieldKind::DOUBLE: { double value; std::memcpy(&value, mbr, 8); return value == 0.0; }
+        default: return LoadInteger(mbr, entry.width, false) == 0;
+    }
+}
+
+inline std::size_t TableSizeFields(const MessageTable& table, const void* msg, SizeCache& cache);
+template<OutputSink S>
+void TableWriteFields(S& tgt, const MessageTable& table, const void* msg, SizeCache& cache);
+inline ParseResult TableReadFields(ConstDataBlock data, const MessageTable& table, void* msg);
+
+// mirrors ByteSize, including the order embedded messages take their slots in the cache
+inline std::size_t TableSizeFields(const MessageTable& table, const void* msg, SizeCache& cache)
+{
+    const auto* base = static_cast<const std::byte*>(msg);
+    std::size_t size{0};
+    const auto embedded = [&cache](const FieldEntry& entry, const void* mbr, bool present) -> std::size_t
+    {
+        const auto slot = cache.open();
+        const auto msg_size = TableSizeFields(entry.sub(), mbr, cache);
+        cache.close(slot, msg_size);
+        return (msg_size || present) ? entry.tag.size + VarintSize(msg_size) + msg_size : 0;
+    };
+    for (const auto idx : table.write_order)
+    {
+        const auto& entry = table.fields[idx];
+        const auto* mbr = base+entry.offset;
+        switch (entry.kind)
+        {
+            case FieldKind::VARINT:
+            case FieldKind::ZIGZAG:
+                if (LoadInteger(mbr, entry.width, false) != 0)
+                    size += entry.tag.size + VarintSize(WireVarint(entry, mbr));
+                break;
+            case FieldKind::BOOL:
+                if (*reinterpret_cast<const bool*>(mbr))
+                    size += entry.tag.size + 1;
+                break;
+            case FieldKind::FIXED:
+            case FieldKind::FLOAT:
+            case FieldKind::DOUBLE:
+                if (!IsDefaultFixed(entry, mbr))
+                    size += entry.tag.size + entry.width;
+                break;
+            case FieldKind::STRING:
+            {
+                const auto& str = *reinterpret_cast<const std::string*>(mbr);
+                if (!str.empty())
+                    size += entry.tag.size + VarintSize(str.size()) + str.size();
+                break;
+            }
+            case FieldKind::MESSAGE:
+                size += embedded(entry, mbr, false);
+                break;
+            case FieldKind::MESSAGES:
+                for (std::size_t idx = 0, count = entry.count(mbr); idx < count; ++idx)
+                    size += embedded(entry, entry.at(mbr, idx), true);
+                break;
+            case FieldKind::OTHER:
+                size += entry.size(msg, cache);
+                break;
+        }
+    }
+    if (table.unknown_offset >= 0)
+        size += reinterpret_cast<const UnknownFields*>(base+table.unknown_offset)->size();
+    return size;
+}
+
+// mirrors WriteMessage
+template<OutputSink S>
+void TableWriteFields(S& tgt, const MessageTable& table, const void* msg, SizeCache& cache)
+{
+    auto scope = InstrumentCall(table.encode_scope);
+    const auto start = InstrumentPosition(tgt);
+    const auto* base = static_cast<const std::byte*>(msg);
+    // the tag and, for a scalar, the value go out together
+    std::array<std::byte, 5+10> head;
+    const auto put_tag = [&head](const FieldEntry& entry)
+    {
+        std::memcpy(head.data(), entry.tag.bytes.data(), entry.tag.size);
+        return entry.tag.size;
+    };
+    const auto embedded = [&](const FieldEntry& entry, const void* mbr, bool present)
+    {
+        const auto msg_size = cache.pop();
+        if (msg_size || present)
+        {
+            auto used = put_tag(entry);
+            used += EncodeVarint(msg_size, head.data()+used);
+            sink_write(tgt, ConstDataBlock{head.data(), used});
+            if (msg_size)   // as WriteEmbedded, nothing inside an empty message is in the cache
+                TableWriteFields(tgt, entry.sub(), mbr, cache);
+        }
+    };
+    for (const auto idx : table.write_order)
+    {
+        const auto& entry = table.fields[idx];
+        const auto* mbr = base+entry.offset;
+        const auto field_start = InstrumentPosition(tgt);
+        std::size_t records{1};
+        switch (entry.kind)
+        {
+            case FieldKind::VARINT:
+            case FieldKind::ZIGZAG:
+                if (LoadInteger(mbr, entry.width, false) != 0)
+                {
+                    auto used = put_tag(entry);
+                    used += EncodeVarint(WireVarint(entry, mbr), head.data()+used);
+                    sink_write(tgt, ConstDataBlock{head.data(), used});
+                }
+                break;
+            case FieldKind::BOOL:
+                if (*reinterpret_cast<const bool*>(mbr))
+                {
+                    auto used = put_tag(entry);
+                    head[used++] = std::byte{1};
+                    sink_write(tgt, ConstDataBlock{head.data(), used});
+                }
+                break;
+            case FieldKind::FIXED:
+            case FieldKind::FLOAT:
+            case FieldKind::DOUBLE:
+                if (!IsDefaultFixed(entry, mbr))
+                {
+                    auto used = put_tag(entry);
+                    if (entry.width == 4)
+                        store_le32(head.data()+used, static_cast<std::uint32_t>(LoadInteger(mbr, 4, false)));
+                    else
+                        store_le64(head.data()+used, LoadInteger(mbr, 8, false));
+                    sink_write(tgt, ConstDataBlock{head.data(), used+entry.width});
+                }
+                break;
+            case FieldKind::STRING:
+            {
+                const auto& str = *reinterpret_cast<const std::string*>(mbr);
+                if (!str.empty())
+                {
+                    auto used = put_tag(entry);
+                    used += EncodeVarint(str.size(), head.data()+used);
+                    sink_write(tgt, ConstDataBlock{head.data(), used});
+                    sink_write(tgt, std::as_bytes(std::span{str.data(), str.size()}));
+                }
+                break;
+            }
+            case FieldKind::MESSAGE:
+                embedded(entry, mbr, false);
+                break;
+            case FieldKind::MESSAGES:
+                records = entry.count(mbr);
+                for (std::size_t elem = 0; elem < records; ++elem)
+                    embedded(entry, entry.at(mbr, elem), true);
+                break;
+            case FieldKind::OTHER:
+                if constexpr (std::is_same_v<S, DataBlock>)
+                    entry.write(tgt, msg, cache);
+                else if constexpr (std::is_same_v<S, ErasedSink>)
+                    entry.write_erased(tgt, msg, cache);
+                else
+                {
+                    ErasedSink erased{tgt};
+                    entry.write_erased(erased, msg, cache);
+                }
+                break;
+        }
+        scope.field(idx, InstrumentPosition(tgt)-field_start, records);
+    }
+    if (table.unknown_offset >= 0)
+        sink_write(tgt, reinterpret_cast<const UnknownFields*>(base+table.unknown_offset)->data());
+    scope.finish(InstrumentPosition(tgt)-start);
+}
+
+// mirrors operator>> of a message
+inline ParseResult TableReadFields(ConstDataBlock data, const MessageTable& table, void* msg)
+{
+    auto scope = InstrumentCall(table.decode_scope);
+    const auto start_size = data.size();
+    auto* base = static_cast<std::byte*>(msg);
+    std::size_t expected{table.first};
+    while (!data.empty())
+    {
+        const auto field_start = data;
+        std::size_t idx;
+        WireType type;
+        if (expected < table.fields.size() && StartsWithTag(data, table.fields[expected].tag))
+        {
+            idx = expected;
+            type = static_cast<WireType>(table.fields[idx].tag.value&7);
+            data = data.subspan(table.fields[idx].tag.size);
+        }
+        else
+        {
+            FieldID id;
+            const auto tag = ReadTag(data, id, type);
+            if (!tag)
+                return tag;
+            data = tag.rest();
+            idx = table.find(id);
+        }
+        if (idx < table.fields.size())
+        {
+            const auto& entry = table.fields[idx];
+            expected = table.next[idx];
+            auto* mbr = base+entry.offset;
+            if (entry.kind != FieldKind::OTHER && type != static_cast<WireType>(entry.tag.value&7))
+                return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+            ParseResult res{data};
+            ConstDataBlock bytes;
+            switch (entry.kind)
+            {
+                case FieldKind::VARINT:
+                case FieldKind::BOOL:
+                case FieldKind::ZIGZAG:
+                {
+                    std::uint64_t value;
+                    res = data >> value;
+                    if (!res)
+                        break;
+                    if (entry.kind == FieldKind::BOOL)
+                        *reinterpret_cast<bool*>(mbr) = value != 0;
+                    else if (entry.kind == FieldKind::VARINT)
+                        StoreInteger(mbr, value, entry.width);
+                    else if (entry.width <= 4)
+                        StoreInteger(mbr, static_cast<std::uint64_t>(ZigZagDecode32(static_cast<std::uint32_t>(value))), entry.width);
+                    else
+                        StoreInteger(mbr, static_cast<std::uint64_t>(ZigZagDecode64(value)), entry.width);
+                    break;
+                }
+                case FieldKind::FIXED:
+                case FieldKind::FLOAT:
+                case FieldKind::DOUBLE:
+                    if (data.size() < entry.width)
+                        return ParseResult::failure(ParseError::TRUNCATED, data);
+                    if (entry.width == 4)
+                        StoreInteger(mbr, load_le32(data.data()), 4);
+                    else
+                        StoreInteger(mbr, load_le64(data.data()), 8);
+                    res = data.subspan(entry.width);
+                    break;
+                case FieldKind::STRING:
+                {
+                    res = SplitDelimited(data, bytes);
+                    if (!res)
+                        break;
+                    auto& str = *reinterpret_cast<std::string*>(mbr);
+                    InstrumentAllocation(bytes.size() > str.capacity());
+                    str.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+                    break;
+                }
+                case FieldKind::MESSAGE:
+                case FieldKind::MESSAGES:
+                {
+                    res = SplitDelimited(data, bytes);
+                    if (!res)
+                        break;
+                    const auto inner = entry.kind == FieldKind::MESSAGE ? TableReadFields(bytes, entry.sub(), mbr)
+                                                                        : entry.read_element(bytes, mbr);
+                    if (!inner)
+                        return inner;
+                    break;
+                }
+                case FieldKind::OTHER:
+                    res = entry.read(data, type, msg);
+                    break;
+            }
+            if (!res)
+                return res;
+            data = res.rest();
+            scope.field(idx, field_start.size()-data.size());
+        }
+        else
+        {
+            const auto res = SkipField(data, type);
+            if (!res)
+                return res;
+            data = res.rest();
+            if (table.unknown_offset >= 0)
+                reinterpret_cast<UnknownFields*>(base+table.unknown_offset)->append(field_start.first(field_start.size()-data.size()));
+        }
+    }
+    scope.finish(start_size);
+    return data;
+}
+
+// the kind of member a T is
+template<class T>
+constexpr FieldKind table_kind()
+{
+    if constexpr (std::is_same_v<T, bool>)
+        return FieldKind::BOOL;
+    else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+        return FieldKind::VARINT;
+    else if constexpr (std::is_same_v<T, float>)
+        return FieldKind::FLOAT;
+    else if constexpr (std::is_same_v<T, double>)
+        return FieldKind::DOUBLE;
+    else if constexpr (std::is_same_v<T, std::string>)
+        return FieldKind::STRING;
+    else if constexpr (is_proto_struct_v<T>)
+        return table_driven_v<T> ? FieldKind::MESSAGE : FieldKind::OTHER;
+    else if constexpr (requires { typename T::tag_type; typename T::value_type; })
+    {
+        // a wrapper that is only its value, so the value can be read in place
+        using V = typename T::value_type;
+        if constexpr (!std::is_integral_v<V> || std::is_same_v<V, bool> || sizeof(T) != sizeof(V) ||
+                      !std::is_standard_layout_v<T> || !std::is_trivially_copyable_v<T>)
+            return FieldKind::OTHER;
+        else if constexpr (std::is_same_v<typename T::tag_type, SignedTag>)
+            return FieldKind::ZIGZAG;
+        else if constexpr (std::is_same_v<typename T::tag_type, FixedTag>)
+            return (sizeof(V)==4 || sizeof(V)==8) ? FieldKind::FIXED : FieldKind::OTHER;
+        else
+            return FieldKind::OTHER;
+    }
+    else if constexpr (is_non_string_container_v<T>)
+    {
+        using E = typename T::value_type;
+        if constexpr (std::is_same_v<T, std::vector<E>> && is_proto_struct_v<E>)
+            return table_driven_v<E> ? FieldKind::MESSAGES : FieldKind::OTHER;
+        else
+            return FieldKind::OTHER;
+    }
+    else
+        return FieldKind::OTHER;
+}
+
+template<ProtoStruct PS> struct TableOf;
+
+// reads an element of a repeated message, added to elems only once it has been read in full
+template<ProtoStruct E>
+inline ParseResult TableReadElement(ConstDataBlock payload, void* elems)
+{
+    auto& vec = *static_cast<std::vector<E>*>(elems);
+    E elem{};
+    const auto res = TableReadFields(payload, TableOf<E>::get(), &elem);
+    if (res)
+    {
+        InstrumentAllocation(vec.size()==vec.capacity());
+        vec.push_back(std::move(elem));
+    }
+    return res;
+}
+
+template<ProtoStruct PS>
+struct TableOf
+{
+    static constexpr std::size_t count = proto_member_count<PS>;
+
+    template<std::size_t I>
+    using member_type = std::remove_cvref_t<decltype(std::declval<PS&>().*(proto_member<PS, I>.pointer))>;
+
+    static constexpr auto numbers = [] <std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        return std::array<FieldID, count>{ proto_member<PS, Is>.field_num... };
+    }(std::make_index_sequence<count>{});
+    static constexpr FieldID max_field = count ? *std::max_element(numbers.begin(), numbers.end()) : 0;
+    static constexpr bool is_dense = max_field < 256 || static_cast<std::size_t>(max_field) < 8*count;
+
+    static constexpr auto by_number = []
+    {
+        std::array<std::uint16_t, is_dense ? max_field+1 : 0> table{};
+        for (auto& idx : table)
+            idx = count;
+        for (std::size_t idx = count; is_dense && idx-- > 0;)   // backwards, so the first of any duplicate wins
+            if (numbers[idx] >= 0)
+                table[numbers[idx]] = idx;
+        return table;
+    }();
+    static constexpr auto sorted = []
+    {
+        std::array<std::pair<FieldID, std::uint16_t>, is_dense ? 0 : count> table{};
+        for (std::size_t idx = 0; idx < table.size(); ++idx)
+            table[idx] = {numbers[idx], idx};
+        std::sort(table.begin(), table.end());
+        return table;
+    }();
+    static constexpr auto as_positions(const std::array<std::size_t, count>& from)
+    {
+        std::array<std::uint16_t, count> res{};
+        std::copy(from.begin(), from.end(), res.begin());
+        return res;
+    }
+    static constexpr auto order = as_positions(write_order<PS>);
+    static constexpr auto next = as_positions(FieldPrediction<PS>::next);
+
+    template<std::size_t I>
+    static ParseResult read(ConstDataBlock data, WireType type, void* msg)
+    {
+        return ReadMember<PS, I>(data, type, *static_cast<PS*>(msg));
+    }
+    template<std::size_t I>
+    static std::size_t size(const void* msg, SizeCache& cache)
+    {
+        return MemberSize<PS, I>(static_cast<const PS*>(msg)->*(proto_member<PS, I>.pointer), cache);
+    }
+    template<std::size_t I, OutputSink S>
+    static void write(S& tgt, const void* msg, SizeCache& cache)
+    {
+        WriteMember<PS, I>(tgt, static_cast<const PS*>(msg)->*(proto_member<PS, I>.pointer), cache);
+    }
+
+    template<std::size_t I>
+    static FieldEntry entry(const PS& probe)
+    {
+        using T = member_type<I>;
+        constexpr auto kind = table_kind<T>();
+        FieldEntry res{};
+        res.tag = member_tag<PS, I>;
+        res.kind = kind;
+        res.offset = static_cast<std::size_t>(reinterpret_cast<const std::byte*>(&(probe.*(proto_member<PS, I>.pointer))) -
+                                              reinterpret_cast<const std::byte*>(&probe));
+        if constexpr (kind == FieldKind::VARINT)
+        {
+            res.width = sizeof(T);
+            if constexpr (std::is_enum_v<T>)
+                res.is_signed = std::is_signed_v<std::underlying_type_t<T>>;
+            else
+                res.is_signed = std::is_signed_v<T>;
+        }
+        else if constexpr (kind == FieldKind::ZIGZAG || kind == FieldKind::FIXED)
+        {
+            res.width = sizeof(T);
+            res.is_signed = std::is_signed_v<typename T::value_type>;
+        }
+        else if constexpr (kind == FieldKind::FLOAT || kind == FieldKind::DOUBLE)
+            res.width = sizeof(T);
+        else if constexpr (kind == FieldKind::MESSAGE)
+            res.sub = &TableOf<T>::get;
+        else if constexpr (kind == FieldKind::MESSAGES)
+        {
+            using E = typename T::value_type;
+            res.sub = &TableOf<E>::get;
+            res.count = [](const void* mbr) { return static_cast<const T*>(mbr)->size(); };
+            res.at = [](const void* mbr, std::size_t idx) -> const void* { return &(*static_cast<const T*>(mbr))[idx]; };
+            res.read_element = &TableReadElement<E>;
+        }
+        else
+        {
+            res.read = &read<I>;
+            res.size = &size<I>;
+            res.write = &write<I, DataBlock>;
+            res.write_erased = &write<I, ErasedSink>;
+        }
+        return res;
+    }
+
+    static const MessageTable& get()
+    {
+        static const auto fields = []
+        {
+            const PS probe{};
+            return [&] <std::size_t... Is>(std::index_sequence<Is...>)
+            {
+                return std::array<FieldEntry, count>{ entry<Is>(probe)... };
+            }(std::make_index_sequence<count>{});
+        }();
+        static const MessageTable table = []
+        {
+            std::ptrdiff_t unknown_offset{-1};
+            if constexpr (KeepsUnknownFields<PS>)
+            {
+                PS probe{};
+                unknown_offset = reinterpret_cast<const std::byte*>(&probe.unknown_fields) - reinterpret_cast<const std::byte*>(&probe);
+            }
+            return MessageTable{fields, by_number, sorted, order, next, FieldPrediction<PS>::first, unknown_offset,
+                                &InstrumentEncode<PS>, &InstrumentDecode<PS>};
+        }();
+        return table;
+    }
+};
+
+template<ProtoStruct PS>
+inline std::size_t TableByteSize(const PS& obj, SizeCache& cache)
+{
+    return TableSizeFields(TableOf<PS>::get(), &obj, cache);
+}
+
+template<OutputSink S, ProtoStruct PS>
+inline void TableWriteMessage(S& tgt, const PS& obj, SizeCache& cache)
+{
+    TableWriteFields(tgt, TableOf<PS>::get(), &obj, cache);
+}
+
+template<ProtoStruct PS>
+inline ParseResult TableReadMessage(ConstDataBlock data, PS& tgt)
+{
+    return TableReadFields(data, TableOf<PS>::get(), &tgt);
+}
@@ -0,0 +1,186 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads, each with its own queue of tasks.
+// A task submitted from a worker goes on that worker's queue, where it is taken newest first (it is likely to
+// share data with the task that submitted it), and a task submitted from outside is dealt to the queues in
+// turn. A worker with nothing on its own queue steals the oldest task from another.
+// parallel_for() is the main use: it splits a range of indices into chunks that the workers and the calling thread
+// take in turn, and returns once every chunk is done. The caller always takes part, so a pool with no workers
+// (or one that is busy) still makes progress, and parallel_for() may be called from inside a task.
+class ThreadPool
+{
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    std::atomic<std::size_t> pending{0};    // tasks queued and not yet taken
+    std::atomic<std::size_t> deal{0};
+    bool stopping{false};
+
+    // the pool and queue of the worker running on this thread
+    static inline thread_local ThreadPool* current_pool{nullptr};
+    static inline thread_local std::size_t current_queue{0};
+
+    bool take(std::size_t idx, std::function<void()>& task)
+    {
+        {
+            std::lock_guard guard{queues[idx]->lock};
+            auto& own = queues[idx]->tasks;
+            if (!own.empty())
+            {
+                task = std::move(own.back());
+                own.pop_back();
+                --pending;
+                return true;
+            }
+        }
+        for (std::size_t offset = 1; offset < queues.size(); ++offset)
+        {
+            auto& victim = *queues[(idx+offset)%queues.size()];
+            std::lock_guard guard{victim.lock};
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                --pending;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(std::size_t idx)
+    {
+        current_pool = this;
+        current_queue = idx;
+        for (;;)
+        {
+            std::function<void()> task;
+            if (take(idx, task))
+            {
+                task();
+                continue;
+            }
+            std::unique_lock guard{sleep_lock};
+            wake.wait(guard, [this] { return stopping || pending > 0; });
+            if (stopping && pending == 0)
+                return;
+        }
+    }
+
+public:
+    // threads is the number of workers, the calling thread of parallel_for() comes on top
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency()-1 : 0)
+    {
+        for (std::size_t idx = 0; idx < threads; ++idx)
+            queues.push_back(std::make_unique<Queue>());
+        workers.reserve(threads);
+        for (std::size_t idx = 0; idx < threads; ++idx)
+            workers.emplace_back([this, idx] { run(idx); });
+    }
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard guard{sleep_lock};
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    std::size_t size() const { return workers.size(); }
+
+    // with no workers the task runs at once, on the calling thread
+    void submit(std::function<void()> task)
+    {
+        if (workers.empty())
+        {
+            task();
+            return;
+        }
+        const auto idx = (current_pool == this) ? current_queue : deal++ % queues.size();
+        {
+            std::lock_guard guard{sleep_lock};
+            ++pending;      // counted first, so a thief never takes it below zero
+        }
+        {
+            std::lock_guard guard{queues[idx]->lock};
+            queues[idx]->tasks.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // calls fn(idx) for every idx in [0, count), returns when all calls have returned
+    // the first exception thrown by fn is rethrown here, once the other chunks are done
+    template<class Fn>
+    void parallel_for(std::size_t count, Fn&& fn)
+    {
+        if (count == 0)
+            return;
+        const std::size_t chunks = std::min(count, (workers.size()+1)*4);
+        if (chunks == 1 || workers.empty())
+        {
+            for (std::size_t idx = 0; idx < count; ++idx)
+                fn(idx);
+            return;
+        }
+        // helpers may start after the call has returned, so what they share lives on the heap
+        struct Shared
+        {
+            std::atomic<std::size_t> next{0};
+            std::atomic<std::size_t> done{0};
+            std::mutex lock;
+            std::condition_variable finished;
+            std::exception_ptr error;
+        };
+        auto shared = std::make_shared<Shared>();
+        // fn is only called for a chunk taken before the last one is done, so while the caller still waits
+        const auto work = [shared, chunks, count, &fn]
+        {
+            for (std::size_t chunk; (chunk = shared->next++) < chunks;)
+            {
+                try
+                {
+                    for (std::size_t idx = chunk*count/chunks; idx < (chunk+1)*count/chunks; ++idx)
+                        fn(idx);
+                }
+                catch (...)
+                {
+                    std::lock_guard guard{shared->lock};
+                    if (!shared->error)
+                        shared->error = std::current_exception();
+                }
+                if (++shared->done == chunks)
+                {
+                    std::lock_guard guard{shared->lock};
+                    shared->finished.notify_all();
+                }
+            }
+        };
+        for (std::size_t idx = 0; idx < std::min(workers.size(), chunks-1); ++idx)
+            submit(work);
+        work();
+        std::unique_lock guard{shared->lock};
+        shared->finished.wait(guard, [&] { return shared->done == chunks; });
+        if (shared->error)
+            std::rethrow_exception(shared->error);
+    }
+};
@@ -0,0 +1,196 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <bit>
+#if defined(__BMI2__) && !defined(TINYPB_NO_BMI2)
+#include <immintrin.h>
+#define TINYPB_VARINT_BMI2 1
+#endif
+
+// varint and zigzag kernels
+// The encoder and decoder work on whole 64 bit words: the 7 bit groups are spread/gathered with pdep/pext when
+// BMI2 is enabled at compile time (-mbmi2 or -march=native), and with a fixed shift-and-mask sequence otherwise.
+// Either way there is no per-byte branch. Note pdep/pext are microcoded (slow) on AMD before Zen 3, build with
+// TINYPB_NO_BMI2 defined for those.
+
+constexpr std::uint64_t varint_payload_bits{0x7F7F7F7F7F7F7F7Full};
+constexpr std::uint64_t varint_continue_bits{0x8080808080808080ull};
+
+inline std::uint64_t load_le64(const std::byte* src)
+{
+    std::uint64_t word;
+    std::memcpy(&word, src, sizeof(word));
+    if constexpr (std::endian::native == std::endian::big)
+        word = __builtin_bswap64(word);
+    return word;
+}
+
+inline void store_le64(std::byte* tgt, std::uint64_t word)
+{
+    if constexpr (std::endian::native == std::endian::big)
+        word = __builtin_bswap64(word);
+    std::memcpy(tgt, &word, sizeof(word));
+}
+
+inline std::uint32_t load_le32(const std::byte* src)
+{
+    std::uint32_t word;
+    std::memcpy(&word, src, sizeof(word));
+    if constexpr (std::endian::native == std::endian::big)
+        word = __builtin_bswap32(word);
+    return word;
+}
+
+inline void store_le32(std::byte* tgt, std::uint32_t word)
+{
+    if constexpr (std::endian::native == std::endian::big)
+        word = __builtin_bswap32(word);
+    std::memcpy(tgt, &word, sizeof(word));
+}
+
+// number of bytes needed to encode val, 1..10
+constexpr std::size_t VarintSize(std::uint64_t val)
+{
+    return (std::bit_width(val|1)*9 + 64)/64;
+}
+
+// spread the low 56 bits of val into the low 7 bits of 8 bytes
+inline std::uint64_t spread_7bit_groups(std::uint64_t val)
+{
+#ifdef TINYPB_VARINT_BMI2
+    return _pdep_u64(val, varint_payload_bits);
+#else
+    return  (val & 0x000000000000007Full)       |
+            ((val & 0x0000000000003F80ull)<<1)  |
+            ((val & 0x00000000001FC000ull)<<2)  |
+            ((val & 0x000000000FE00000ull)<<3)  |
+            ((val & 0x00000007F0000000ull)<<4)  |
+            ((val & 0x000003F800000000ull)<<5)  |
+            ((val & 0x0001FC0000000000ull)<<6)  |
+            ((val & 0x00FE000000000000ull)<<7);
+#endif
+}
+
+// gather the low 7 bits of 8 bytes into the low 56 bits
+inline std::uint64_t gather_7bit_groups(std::uint64_t word)
+{
+#ifdef TINYPB_VARINT_BMI2
+    return _pext_u64(word, varint_payload_bits);
+#else
+    return  (word & 0x000000000000007Full)       |
+            ((word & 0x0000000000007F00ull)>>1)  |
+            ((word & 0x00000000007F0000ull)>>2)  |
+            ((word & 0x000000007F000000ull)>>3)  |
+            ((word & 0x0000007F00000000ull)>>4)  |
+            ((word & 0x00007F0000000000ull)>>5)  |
+            ((word & 0x007F000000000000ull)>>6)  |
+            ((word & 0x7F00000000000000ull)>>7);
+#endif
+}
+
+// writes val to tgt, which must have room for 10 bytes, and returns the number of bytes used
+inline std::size_t EncodeVarint(std::uint64_t val, std::byte* tgt)
+{
+    if (val < 0x80)
+    {
+        tgt[0] = static_cast<std::byte>(val);
+        return 1;
+    }
+    if (val < 0x4000)
+    {
+        tgt[0] = static_cast<std::byte>(val | 0x80);
+        tgt[1] = static_cast<std::byte>(val >> 7);
+        return 2;
+    }
+    const auto size = VarintSize(val);
+    const auto spread = spread_7bit_groups(val);
+    if (size <= 8)
+    {
+        // continuation bits on every byte but the last
+        const auto continues = varint_continue_bits >> (8*(9-size));
+        store_le64(tgt, spread | continues);
+        return size;
+    }
+    // bit 63 is both the continuation bit of byte 8 and the only payload bit of byte 9
+    store_le64(tgt, spread | varint_continue_bits);
+    const auto top = val >> 56;
+    tgt[8] = static_cast<std::byte>(top);
+    tgt[9] = static_cast<std::byte>(top >> 7);
+    return size;
+}
+
+// byte at a time decode, used near the end of a buffer
+inline std::size_t DecodeVarintSlow(const std::byte* src, std::size_t available, std::uint64_t& tgt)
+{
+    tgt = 0;
+    const auto limit = available < 10 ? available : 10;
+    for (std::size_t idx = 0; idx < limit; ++idx)
+    {
+        const auto next = static_cast<std::uint64_t>(src[idx]);
+        tgt |= (next&0x7F)<<(7*idx);
+        if (!(next&0x80))
+            return idx+1;
+    }
+    return 0;
+}
+
+// reads a varint from src into tgt and returns the number of bytes used, or 0 if there is no whole varint there
+// (the last available byte, or the 10th, still has its continuation bit set)
+// with 10 or more bytes available, a varint of up to 8 bytes is decoded from one load with no loop
+inline std::size_t DecodeVarint(const std::byte* src, std::size_t available, std::uint64_t& tgt)
+{
+    // one and two byte values dominate most messages (tags, lengths, small ints)
+    if (available && static_cast<std::uint64_t>(src[0]) < 0x80)
+    {
+        tgt = static_cast<std::uint64_t>(src[0]);
+        return 1;
+    }
+    if (available > 1 && static_cast<std::uint64_t>(src[1]) < 0x80)
+    {
+        tgt = (static_cast<std::uint64_t>(src[0])&0x7F) | (static_cast<std::uint64_t>(src[1]) << 7);
+        return 2;
+    }
+    if (available < 10)
+        return DecodeVarintSlow(src, available, tgt);
+    const auto word = load_le64(src);
+    const auto stops = ~word & varint_continue_bits;
+    if (stops)
+    {
+        const auto size = static_cast<std::size_t>(std::countr_zero(stops)/8 + 1);
+        const auto keep = (size==8) ? ~0ull : ((1ull << (8*size)) - 1);
+        tgt = gather_7bit_groups(word & keep);
+        return size;
+    }
+    const auto b8 = static_cast<std::uint64_t>(src[8]);
+    tgt = gather_7bit_groups(word) | ((b8&0x7F) << 56);
+    if (!(b8&0x80))
+        return 9;
+    tgt |= static_cast<std::uint64_t>(src[9]) << 63;
+    return (static_cast<std::uint64_t>(src[9])&0x80) ? 0 : 10;
+}
+
+// zigzag, as used by sint32/sint64
+constexpr std::uint32_t ZigZagEncode32(std::int32_t val)
+{
+    return (static_cast<std::uint32_t>(val) << 1) ^ static_cast<std::uint32_t>(val >> 31);
+}
+
+constexpr std::uint64_t ZigZagEncode64(std::int64_t val)
+{
+    return (static_cast<std::uint64_t>(val) << 1) ^ static_cast<std::uint64_t>(val >> 63);
+}
+
+constexpr std::int32_t ZigZagDecode32(std::uint32_t val)
+{
+    return static_cast<std::int32_t>((val >> 1) ^ (~(val & 1) + 1));
+}
+
+constexpr std::int64_t ZigZagDecode64(std::uint64_t val)
+{
+    return static_cast<std::int64_t>((val >> 1) ^ (~(val & 1) + 1));
+}
+
+static_assert(ZigZagEncode32(0)==0 && ZigZagEncode32(-1)==1 && ZigZagEncode32(1)==2 && ZigZagEncode32(-2)==3);
+static_assert(ZigZagEncode32(-2147483647-1)==0xFFFFFFFF);
+static_assert(ZigZagDecode64(ZigZagEncode64(-0xFFFFFFFFFFFFFFF))==-0xFFFFFFFFFFFFFFF);
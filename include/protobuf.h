@@ -2,17 +2,27 @@
 
 #include <iostream>
 #include <string>
+#include <string_view>
+#include <concepts>
 #include <vector>
+#include <optional>
+#include <memory_resource>
 #include <span>
-#include <map>
 #include <assert.h>
 #include <numeric>
-#include <functional>
+#include <bit>
+#include <algorithm>
+#include <cstring>
+#include <ranges>
 #include "Reflection.h"
 #include "traits.h"
 #include "BasicWrapper.h"
 #include "Enum.h"
 #include "Overloaded.h"
+#include "OutputSink.h"
+#include "VarInt.h"
+#include "ParseResult.h"
+#include "Instrument.h"
 
 // rules for declaring structures/members 
 class NonVarIntTag{};
@@ -28,12 +38,45 @@ class BasicTypeWrapper : public BasicWrapper<T> {
     using tag_type = Tag;
 };
 
+// any std::basic_string of char, whatever its allocator (std::string, std::pmr::string...)
+template<class T> constexpr bool is_string_v{false};
+template<class Traits, class Alloc> constexpr bool is_string_v<std::basic_string<char, Traits, Alloc>>{true};
+template<typename T> concept StringType = is_string_v<T>;
+
+// proto3 "optional": a std::optional member has presence, it is written whenever it holds a value (even the default)
+template<class T> constexpr bool is_optional_v{false};
+template<class T> constexpr bool is_optional_v<std::optional<T>>{true};
+template<typename T> concept OptionalType = is_optional_v<T>;
+template<class T> struct optional_value { using type = T; };
+template<class T> struct optional_value<std::optional<T>> { using type = T; };
+template<class T> using optional_value_t = typename optional_value<T>::type;   // T, or what a std::optional<T> holds
+
+// a message kept with its encoding (Cached.h), written and read as the message would be
+template<ProtoStruct PS> class Cached;
+template<class T> constexpr bool is_cached_v{false};
+template<class PS> constexpr bool is_cached_v<Cached<PS>>{true};
+template<typename T> concept CachedType = is_cached_v<T>;
+template<class T> constexpr bool is_embedded_v = is_proto_struct_v<T> || is_cached_v<T>;   // written as an embedded message
+template<class T> struct embedded_message { using type = T; };
+template<class PS> struct embedded_message<Cached<PS>> { using type = PS; };
+template<class T> using embedded_message_t = typename embedded_message<T>::type;   // the message an embedded T holds
+
+// the message an embedded member holds, for a reader to parse into in place (a Cached through edit())
+template<class T>
+inline embedded_message_t<T>& EmbeddedMessage(T& mbr)
+{
+    if constexpr (is_cached_v<T>)
+        return mbr.edit();
+    else
+        return mbr;
+}
+
 template<typename T> concept NonStringContainer =
     requires { typename T::value_type;} &&  // element must be default constructable
     requires(T t) { t.begin(); } &&
     requires(T t) { t.end(); } &&
     requires(T t) { t.push_back(typename T::value_type{}); } &&
-    !std::is_same_v<std::string, T>;
+    !is_string_v<T>;
 	//members_are_ordered<T>();
 
 
@@ -47,8 +90,9 @@ template<class T> constexpr bool is_signed_v{is_signed<T>::value};
 template<class T> constexpr bool is_non_string_container_v{false};
 template<NonStringContainer T> constexpr bool is_non_string_container_v<T>{true};
 static_assert(!is_non_string_container_v<std::string>);
+static_assert(!is_non_string_container_v<std::pmr::string>);
 static_assert(is_non_string_container_v<std::vector<int>>);
-static_assert(is_non_string_container_v<std::vector<int>>);
+static_assert(is_non_string_container_v<std::pmr::vector<int>>);
 
 // rules for encoding for transmition
 
@@ -91,102 +135,184 @@ template<> constexpr WireType OnWireType<FixedInt<int64_t>>() { return WireType:
 template<> constexpr WireType OnWireType<float>() { return WireType::FIXED32; }
 template<> constexpr WireType OnWireType<double>() { return WireType::FIXED64; }
 // BString
-template<> constexpr WireType OnWireType<std::string>() { return WireType::DELIMITED; }
+template<StringType T> constexpr WireType OnWireType() { return WireType::DELIMITED; }
+template<> constexpr WireType OnWireType<std::string_view>() { return WireType::DELIMITED; }
+template<> constexpr WireType OnWireType<std::span<const std::byte>>() { return WireType::DELIMITED; }
 template<> constexpr WireType OnWireType<char[]>() { return WireType::DELIMITED; }
+template<CachedType T> constexpr WireType OnWireType() { return WireType::DELIMITED; }
+template<OptionalType T> constexpr WireType OnWireType() { return OnWireType<typename T::value_type>(); }
 
-
-// data types
-using DataBlock = std::vector<std::byte>;
-using ConstDataBlock = std::span<const std::byte>;
-inline ConstDataBlock as_const(const DataBlock& v) {return ConstDataBlock{v}; }
+// repeated scalars are written packed: one tag, one length, then the values back to back
+template<class T> constexpr bool is_packable_v = !is_proto_struct_v<T> && !is_non_string_container_v<T> &&
+                                                    OnWireType<T>()!=WireType::DELIMITED;
+static_assert(is_packable_v<int32_t>);
+static_assert(is_packable_v<SignedInt<int64_t>>);
+static_assert(!is_packable_v<std::string>);
 
 
-// rules for writing a structure as a DataBlock
+// rules for writing a structure to an OutputSink
 
-inline DataBlock& operator<<(DataBlock& tgt, std::byte v)
+template<OutputSink S>
+inline S& operator<<(S& tgt, std::byte v)
 {
-    tgt.push_back(v);
+    sink_write(tgt, v);
     return tgt;
 }
 
-inline ConstDataBlock operator>>(ConstDataBlock src, std::byte& v)
+inline ParseResult operator>>(ConstDataBlock src, std::byte& v)
 {
+    if (src.empty())
+        return ParseResult::failure(ParseError::TRUNCATED, src);
     v = src[0];
     return ConstDataBlock{src.subspan(1)};
 }
 
-template<class T>
-inline std::byte EncodeField(FieldID id)
+// a field tag, varint encoded at compile time
+// raw holds the encoded bytes as a little endian integer, so a tag in the input can be matched with one compare
+struct EncodedTag
 {
-    return std::byte{static_cast<std::byte>(id<<3) | static_cast<std::byte>(OnWireType<T>())};
-}
-
+    std::array<std::byte, 5> bytes{};
+    std::size_t size{0};
+    std::uint32_t value{0};
+    std::uint64_t raw{0};
+};
 
-template<class T>
-inline void WriteAsVarint(DataBlock& tgt, T&& obj)
+constexpr EncodedTag EncodeTag(FieldID id, WireType type)
 {
-    std::uint64_t val = static_cast<std::uint64_t>(obj);
+    EncodedTag tag;
+    tag.value = (static_cast<std::uint32_t>(id)<<3) | static_cast<std::uint32_t>(type);
+    auto val = tag.value;
     do
     {
-        std::byte next = static_cast<std::byte>(val)&std::byte{0x7F};
+        const auto next = (val&0x7F) | (val>0x7F ? 0x80 : 0);
+        tag.bytes[tag.size] = static_cast<std::byte>(next);
+        tag.raw |= static_cast<std::uint64_t>(next) << (8*tag.size);
+        ++tag.size;
         val >>= 7;
-        if (val)
-            next |= std::byte{0x80};
-        tgt << next;
     } while (val);
+    return tag;
 }
 
 template<class T>
-inline void WriteAsSignedVarint32(DataBlock& tgt, T&& obj)
+constexpr EncodedTag EncodeField(FieldID id)
 {
-    const std::int32_t val = static_cast<std::int32_t>(obj);
-    const std::uint32_t sval = (val>=0) ? (val<<1) : (uint32_t)(std::abs(val+1)<<1)|1;
-    WriteAsVarint(tgt, sval);
+    return EncodeTag(id, OnWireType<T>());
 }
 
-template<class T>
-inline void WriteAsSignedVarint64(DataBlock& tgt, T&& obj)
+// the tag of member I of PS
+template<class PS, std::size_t I>
+constexpr EncodedTag member_tag = EncodeField<std::remove_cvref_t<decltype(std::declval<PS&>().*(proto_member<PS, I>.pointer))>>(proto_member<PS, I>.field_num);
+
+static_assert(EncodeTag(1, WireType::DELIMITED).size==1 && EncodeTag(1, WireType::DELIMITED).raw==0x0A);
+static_assert(EncodeTag(16, WireType::VARINT).size==2 && EncodeTag(16, WireType::VARINT).raw==0x0180);
+static_assert(EncodeTag(536870911, WireType::FIXED32).size==5);
+
+template<OutputSink S>
+inline void WriteTag(S& tgt, const EncodedTag& tag)
 {
-    std::int64_t val = static_cast<std::int64_t>(obj);
-    const std::uint64_t sval = (obj>=0) ? (val<<1) : ((uint64_t)((std::abs(val+1))<<1)|1);
-    WriteAsVarint(tgt, sval);
+    sink_write(tgt, ConstDataBlock{tag.bytes.data(), tag.size});
 }
 
 
-template<class T>
-inline void WriteAsFixed32(DataBlock& tgt, T&& obj)
+template<OutputSink S, class T>
+inline void WriteAsVarint(S& tgt, T&& obj)
 {
-    std::uint32_t val = static_cast<std::int32_t>(obj);
-    const auto bytes = std::as_bytes(std::span{&val, 1});
-    for(const auto& b: bytes)
-        tgt << b;
+    std::array<std::byte, 10> bytes;
+    const auto size = EncodeVarint(static_cast<std::uint64_t>(obj), bytes.data());
+    sink_write(tgt, ConstDataBlock{bytes.data(), size});
 }
 
 template<class T>
-inline void WriteAsFixed64(DataBlock& tgt, T&& obj)
+inline std::uint32_t ZigZag32(T&& obj)
 {
-    std::uint64_t val = static_cast<std::int32_t>(obj);
-    const auto bytes = std::as_bytes(std::span{&val, 1});
-    for(const auto& b: bytes)
-        tgt << b;
+    return ZigZagEncode32(static_cast<std::int32_t>(obj));
 }
 
 template<class T>
-inline void WriteDelimitedBytes(DataBlock& tgt, T&& obj)
+inline std::uint64_t ZigZag64(T&& obj)
+{
+    return ZigZagEncode64(static_cast<std::int64_t>(obj));
+}
+
+template<OutputSink S, class T>
+inline void WriteAsSignedVarint32(S& tgt, T&& obj)
+{
+    WriteAsVarint(tgt, ZigZag32(obj));
+}
+
+template<OutputSink S, class T>
+inline void WriteAsSignedVarint64(S& tgt, T&& obj)
+{
+    WriteAsVarint(tgt, ZigZag64(obj));
+}
+
+
+// the bits of a fixed width value as they go on the wire: floats keep their representation, integers
+// (including FixedInt) are converted to unsigned with the usual two's complement wrap
+template<class Wire, class T>
+inline Wire FixedWireBits(const T& obj)
+{
+    using this_type = std::remove_cvref_t<T>;
+    if constexpr (std::is_floating_point_v<this_type>)
+        return std::bit_cast<Wire>(obj);
+    else if constexpr (requires { typename this_type::value_type; })
+        return static_cast<Wire>(static_cast<typename this_type::value_type>(obj));
+    else
+        return static_cast<Wire>(obj);
+}
+
+template<OutputSink S, class T>
+inline void WriteAsFixed32(S& tgt, T&& obj)
+{
+    std::array<std::byte, 4> bytes;
+    store_le32(bytes.data(), FixedWireBits<std::uint32_t>(obj));
+    sink_write(tgt, ConstDataBlock{bytes});
+}
+
+template<OutputSink S, class T>
+inline void WriteAsFixed64(S& tgt, T&& obj)
+{
+    std::array<std::byte, 8> bytes;
+    store_le64(bytes.data(), FixedWireBits<std::uint64_t>(obj));
+    sink_write(tgt, ConstDataBlock{bytes});
+}
+
+// true if a packed run of C's elements is byte for byte the container's own storage,
+// so the whole run can be copied in one go
+template<class C> constexpr bool is_bulk_fixed_v = false;
+template<NonStringContainer C> requires std::ranges::contiguous_range<C>
+constexpr bool is_bulk_fixed_v<C> = std::endian::native == std::endian::little &&
+                                    std::is_trivially_copyable_v<typename C::value_type> &&
+                                    ((OnWireType<typename C::value_type>()==WireType::FIXED32 && sizeof(typename C::value_type)==4) ||
+                                     (OnWireType<typename C::value_type>()==WireType::FIXED64 && sizeof(typename C::value_type)==8));
+
+template<OutputSink S, class T>
+inline void WriteDelimitedBytes(S& tgt, T&& obj)
 {
     static_assert(sizeof(obj[0])==1);
     const auto as_span = std::span{obj.data(), obj.size()};
     const auto as_byte_span = std::as_bytes(as_span);
     WriteAsVarint(tgt, (int)as_byte_span.size());
-    for (const std::byte& e: as_byte_span)
-        tgt << e;
+    sink_write(tgt, as_byte_span);
 }
 
-template<class T> class is_string: public std::false_type{};
-template<class CHAR, class ALLOC> class is_string<std::basic_string<CHAR, ALLOC>>: public std::true_type{};
+// string and bytes fields that refer to the parsed buffer rather than owning a copy, see operator>> below
+template<class T> constexpr bool is_borrowed_v = std::is_same_v<T, std::string_view> || std::is_same_v<T, std::span<const std::byte>>;
+template<class T> constexpr bool is_delimited_bytes_v = is_string_v<T> || is_borrowed_v<T>;
 
+// true if a field without presence holds its type's default value, and so is not written
+// (only ever a scalar or a string: embedded messages are skipped when their size is 0, optionals by has_value())
 template<class T>
-inline DataBlock& operator<<(DataBlock& tgt, const T& obj)
+inline bool IsDefault(const T& obj)
+{
+    if constexpr (requires { obj.empty(); })
+        return obj.empty();
+    else
+        return obj == T{};
+}
+
+template<OutputSink S, class T>
+inline S& operator<<(S& tgt, const T& obj)
 {
     using this_type = std::remove_const_t<std::remove_reference_t<T>>;
     constexpr auto type = OnWireType<this_type>();
@@ -205,7 +331,7 @@ inline DataBlock& operator<<(DataBlock& tgt, const T& obj)
         WriteAsFixed64(tgt, obj);
     if constexpr (type==WireType::DELIMITED)
     {
-        if constexpr (std::is_same_v<this_type, std::string>)
+        if constexpr (is_delimited_bytes_v<this_type>)
             WriteDelimitedBytes(tgt, obj);
         else
             tgt << obj;
@@ -215,55 +341,347 @@ inline DataBlock& operator<<(DataBlock& tgt, const T& obj)
 
 
 
+// Unknown fields
+// A message that has a data member "UnknownFields unknown_fields;" (not listed in get_members()) keeps every field
+// the parser does not recognise, tag and payload exactly as they were read, and the writer appends them unchanged.
+// Without one, unknown fields are skipped.
+class UnknownFields
+{
+    DataBlock bytes;
+public:
+    void append(ConstDataBlock field) { bytes.insert(bytes.end(), field.begin(), field.end()); }
+    ConstDataBlock data() const { return ConstDataBlock{bytes}; }
+    std::size_t size() const { return bytes.size(); }
+    bool empty() const { return bytes.empty(); }
+    void clear() { bytes.clear(); }
+    bool operator==(const UnknownFields&) const = default;
+};
+
+template<class T> concept KeepsUnknownFields = requires(T& t) { { t.unknown_fields } -> std::same_as<UnknownFields&>; };
+
+// rules for sizing a structure before it is written
+
+// sizes of embedded messages, recorded in the order the writer meets them
+// the first inline_slots sizes are kept in the cache itself, so a typical message is sized without a heap allocation
+class SizeCache
+{
+    static constexpr std::size_t inline_slots{32};
+    std::array<std::size_t, inline_slots> local;
+    std::vector<std::size_t> overflow;      // the sizes after the first inline_slots
+    std::size_t used{0};
+    std::size_t next{0};
+    std::size_t& at(std::size_t slot) { return slot < inline_slots ? local[slot] : overflow[slot-inline_slots]; }
+public:
+    std::size_t open()
+    {
+        if (used < inline_slots)
+            local[used] = 0;
+        else
+        {
+            InstrumentAllocation(overflow.size()==overflow.capacity());
+            overflow.push_back(0);
+        }
+        return used++;
+    }
+    void close(std::size_t slot, std::size_t size)
+    {
+        at(slot) = size;
+        if (size==0)
+        {
+            used = slot+1;  // nothing inside an empty message is written
+            overflow.resize(used > inline_slots ? used-inline_slots : 0);
+        }
+    }
+    std::size_t pop() { return at(next++); }
+};
+
+// the table driven engine (TableDriven.h) reads and writes a type instead of the templates below if the type
+// declares "static constexpr bool table_driven = true;", or by default if TINYPB_TABLE_DRIVEN is defined as true
+#ifndef TINYPB_TABLE_DRIVEN
+#define TINYPB_TABLE_DRIVEN false
+#endif
+template<class PS> constexpr bool table_driven_v = [] {
+    if constexpr (requires { PS::table_driven; })
+        return bool{PS::table_driven};
+    else
+        return bool{TINYPB_TABLE_DRIVEN};
+}();
+
+// the order members are written in: get_members() order, or ascending field number (whatever the order of
+// get_members()) for a type that declares "static constexpr bool canonical_order = true;", or for every type if
+// TINYPB_CANONICAL_ORDER is defined as true
+#ifndef TINYPB_CANONICAL_ORDER
+#define TINYPB_CANONICAL_ORDER false
+#endif
+template<class PS> constexpr bool canonical_order_v = [] {
+    if constexpr (requires { PS::canonical_order; })
+        return bool{PS::canonical_order};
+    else
+        return bool{TINYPB_CANONICAL_ORDER};
+}();
+
 template<ProtoStruct PS>
-inline DataBlock& operator<<(DataBlock& tgt, const PS& obj)
+constexpr auto write_order = [] {
+    constexpr auto count = proto_member_count<PS>;
+    std::array<std::size_t, count> order{};
+    std::array<FieldID, count> fields{};
+    [&] <std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        ((order[Is] = Is, fields[Is] = proto_member<PS, Is>.field_num), ...);
+    }(std::make_index_sequence<count>{});
+    if constexpr (canonical_order_v<PS>)
+        std::sort(order.begin(), order.end(), [&](auto a, auto b) { return fields[a] < fields[b] || (fields[a]==fields[b] && a < b); });
+    return order;
+}();
+
+// as proto_visit_indexed, in write_order
+template<class Obj, typename Fn>
+inline void proto_visit_ordered(Obj& obj, Fn&& fn)
 {
-    proto_visit(obj, [&tgt](const auto& mbr, auto id)
-		{
-            using this_type = std::remove_const_t<std::remove_reference_t<decltype(mbr)>>;
-            const auto tag = EncodeField<this_type>(id);
-            if constexpr (is_non_string_container_v<this_type>) // this needs updating to support packed types
+    using PS = std::remove_cv_t<Obj>;
+    [&] <std::size_t... Ks>(std::index_sequence<Ks...>)
+    {
+        (fn(obj.*(proto_member<PS, write_order<PS>[Ks]>.pointer), std::integral_constant<std::size_t, write_order<PS>[Ks]>{}), ...);
+    }(std::make_index_sequence<proto_member_count<PS>>{});
+}
+
+template<ProtoStruct PS> std::size_t TableByteSize(const PS& obj, SizeCache& cache);
+template<OutputSink S, ProtoStruct PS> void TableWriteMessage(S& tgt, const PS& obj, SizeCache& cache);
+template<ProtoStruct PS> ParseResult TableReadMessage(ConstDataBlock data, PS& tgt);
+
+template<class T>
+inline std::size_t ValueSize(const T& obj)
+{
+    using this_type = std::remove_const_t<std::remove_reference_t<T>>;
+    constexpr auto type = OnWireType<this_type>();
+    if constexpr (type==WireType::VARINT)
+    {
+        if constexpr (!is_signed_v<this_type>)
+            return VarintSize(static_cast<std::uint64_t>(obj));
+        else if constexpr (sizeof(typename this_type::value_type)<=4)
+            return VarintSize(ZigZag32(obj));
+        else
+            return VarintSize(ZigZag64(obj));
+    }
+    if constexpr (type==WireType::FIXED32)
+        return 4;
+    if constexpr (type==WireType::FIXED64)
+        return 8;
+    if constexpr (type==WireType::DELIMITED)
+        return VarintSize(std::size(obj)) + std::size(obj);
+}
+
+template<ProtoStruct PS>
+inline std::size_t ByteSize(const PS& obj, SizeCache& cache);
+
+// size of an embedded message with its tag and length
+// an empty message is not written at all, unless it is present: a repeated element, or an optional with a value
+template<ProtoStruct PS>
+inline std::size_t EmbeddedSize(std::size_t tag_size, const PS& msg, SizeCache& cache, bool present)
+{
+    const auto slot = cache.open();
+    const auto msg_size = ByteSize(msg, cache);
+    cache.close(slot, msg_size);
+    return (msg_size || present) ? tag_size + VarintSize(msg_size) + msg_size : 0;
+}
+
+// size of the fields that member I of PS adds to the message
+template<ProtoStruct PS, std::size_t I, class T>
+inline std::size_t MemberSize(const T& mbr, SizeCache& cache)
+{
+    constexpr std::size_t tag_size{member_tag<PS, I>.size};
+    if constexpr (is_optional_v<T>)
+    {
+        if (!mbr.has_value())
+            return 0;
+        if constexpr (is_embedded_v<typename T::value_type>)
+            return EmbeddedSize(tag_size, *mbr, cache, true);
+        else
+            return tag_size + ValueSize(*mbr);
+    }
+    else if constexpr (is_non_string_container_v<T>)
+    {
+        using elem_type = typename T::value_type;
+        std::size_t size{0};
+        if constexpr (is_packable_v<elem_type>)
+        {
+            if (std::begin(mbr)!=std::end(mbr))
             {
-                for (const auto& elem:mbr)
+                const auto slot = cache.open();
+                std::size_t run_size{0};
+                if constexpr (OnWireType<elem_type>()==WireType::VARINT)
                 {
-                    using elem_type = std::remove_const_t<std::remove_reference_t<decltype(elem)>>;
-                    if (elem != elem_type{})
-                    {
-                        tgt << tag;
-                        if constexpr (!is_proto_struct_v<elem_type>)
-                            tgt << elem;
-                        else
-                        {
-                            // message
-                            DataBlock tmp;
-                            tmp << elem;
-                            WriteAsVarint(tgt, (int)std::size(tmp));
-                            tgt.insert(tgt.end(), tmp.begin(), tmp.end());
-                        }
-                    }
+                    for (const auto& elem:mbr)
+                        run_size += ValueSize(elem);
                 }
+                else
+                    run_size = std::size(mbr) * (OnWireType<elem_type>()==WireType::FIXED32 ? 4 : 8);
+                cache.close(slot, run_size);
+                size += tag_size + VarintSize(run_size) + run_size;
             }
-            else if constexpr (!is_proto_struct_v<this_type>)
+        }
+        else
+        {
+            // every element is written, default or not
+            for (const auto& elem:mbr)
             {
-                if (mbr != decltype(mbr){})
+                if constexpr (is_embedded_v<elem_type>)
+                    size += EmbeddedSize(tag_size, elem, cache, true);
+                else
+                    size += tag_size + ValueSize(elem);
+            }
+        }
+        return size;
+    }
+    else if constexpr (!is_embedded_v<T>)
+        return IsDefault(mbr) ? 0 : tag_size + ValueSize(mbr);
+    else
+        return EmbeddedSize(tag_size, mbr, cache, false);
+}
+
+template<ProtoStruct PS>
+inline std::size_t ByteSize(const PS& obj, SizeCache& cache)
+{
+    if constexpr (table_driven_v<PS>)
+        return TableByteSize(obj, cache);
+    else
+    {
+        std::size_t size{0};
+        proto_visit_ordered(obj, [&size, &cache](const auto& mbr, auto index)
+		{
+                size += MemberSize<PS, index>(mbr, cache);
+		});
+        if constexpr (KeepsUnknownFields<PS>)
+            size += obj.unknown_fields.size();
+        return size;
+    }
+}
+
+// number of bytes "tgt << obj" appends
+template<ProtoStruct PS>
+inline std::size_t ByteSize(const PS& obj)
+{
+    SizeCache cache;
+    return ByteSize(obj, cache);
+}
+
+template<OutputSink S, ProtoStruct PS>
+inline void WriteMessage(S& tgt, const PS& obj, SizeCache& cache);
+
+// writes an embedded message sized by EmbeddedSize
+template<OutputSink S, ProtoStruct PS>
+inline void WriteEmbedded(S& tgt, const EncodedTag& tag, const PS& msg, SizeCache& cache, bool present)
+{
+    const auto msg_size = cache.pop();
+    if (msg_size || present)
+    {
+        WriteTag(tgt, tag);
+        WriteAsVarint(tgt, msg_size);
+        if (msg_size)   // the sizes inside an empty message were dropped from the cache
+            WriteMessage(tgt, msg, cache);
+    }
+}
+
+// writes the fields of member I of PS
+template<ProtoStruct PS, std::size_t I, OutputSink S, class T>
+inline void WriteMember(S& tgt, const T& mbr, SizeCache& cache)
+{
+    constexpr auto tag = member_tag<PS, I>;
+    if constexpr (is_optional_v<T>)
+    {
+        if (mbr.has_value())
+        {
+            if constexpr (is_embedded_v<typename T::value_type>)
+                WriteEmbedded(tgt, tag, *mbr, cache, true);
+            else
+            {
+                WriteTag(tgt, tag);
+                tgt << *mbr;
+            }
+        }
+    }
+    else if constexpr (is_non_string_container_v<T>)
+    {
+        using elem_type = typename T::value_type;
+        if constexpr (is_packable_v<elem_type>)
+        {
+            if (std::begin(mbr)!=std::end(mbr))
+            {
+                WriteTag(tgt, tag);
+                WriteAsVarint(tgt, cache.pop());
+                if constexpr (is_bulk_fixed_v<T>)
+                    sink_write(tgt, std::as_bytes(std::span{mbr}));
+                else
                 {
-                    tgt << tag;
-                    tgt << mbr;
+                    for (const auto& elem:mbr)
+                        tgt << elem;
                 }
             }
-            else
+        }
+        else
+        {
+            for (const auto& elem:mbr)
             {
-                // message
-                DataBlock tmp;
-                tmp << mbr;
-                if (!tmp.empty())
+                if constexpr (is_embedded_v<elem_type>)
+                    WriteEmbedded(tgt, tag, elem, cache, true);
+                else
                 {
-                    tgt << tag;
-                    WriteAsVarint(tgt, (int)std::size(tmp));
-                    tgt.insert(tgt.end(), tmp.begin(), tmp.end());
+                    WriteTag(tgt, tag);
+                    tgt << elem;
                 }
             }
+        }
+    }
+    else if constexpr (!is_embedded_v<T>)
+    {
+        if (!IsDefault(mbr))
+        {
+            WriteTag(tgt, tag);
+            tgt << mbr;
+        }
+    }
+    else
+        WriteEmbedded(tgt, tag, mbr, cache, false);
+}
+
+// writes the fields of obj, taking embedded message sizes from a cache filled by ByteSize
+template<OutputSink S, ProtoStruct PS>
+inline void WriteMessage(S& tgt, const PS& obj, SizeCache& cache)
+{
+    if constexpr (table_driven_v<PS>)
+        TableWriteMessage(tgt, obj, cache);
+    else
+    {
+        auto scope = InstrumentEncode<PS>();
+        const auto start = InstrumentPosition(tgt);
+        proto_visit_ordered(obj, [&tgt, &cache, &scope](const auto& mbr, auto index)
+		{
+                using this_type = std::remove_cvref_t<decltype(mbr)>;
+                const auto field_start = InstrumentPosition(tgt);
+                WriteMember<PS, index>(tgt, mbr, cache);
+                std::size_t records{1};
+                if constexpr (is_non_string_container_v<this_type>)
+                    if constexpr (!is_packable_v<typename this_type::value_type>)
+                        records = std::size(mbr);   // a record per element
+                scope.field(index, InstrumentPosition(tgt)-field_start, records);
 		});
+        if constexpr (KeepsUnknownFields<PS>)
+            sink_write(tgt, obj.unknown_fields.data());
+        scope.finish(InstrumentPosition(tgt)-start);
+    }
+}
+
+// two passes: size every embedded message, then encode each byte once into a buffer reserved up front
+template<OutputSink S, ProtoStruct PS>
+inline S& operator<<(S& tgt, const PS& obj)
+{
+    SizeCache cache;
+    const auto size = ByteSize(obj, cache);
+    if constexpr (std::is_same_v<S, DataBlock>)
+        InstrumentAllocation(tgt.size()+size > tgt.capacity());
+    sink_reserve(tgt, size);
+    auto&& sink = InstrumentSink(tgt);
+    WriteMessage(sink, obj, cache);
     return tgt;
 }
 
@@ -272,15 +690,18 @@ inline DataBlock& operator<<(DataBlock& tgt, const PS& obj)
 
 // rules for writing the schema
 
-template<class PS, class T>
-inline std::string type_as_string(T p)
+template<class RawType>
+inline std::string type_name()
 {
     using namespace std::string_literals;
-    using RawType = std::remove_const_t<std::remove_reference_t<decltype(std::declval<PS>().*p)>>;
+    if constexpr (is_optional_v<RawType>)
+        return "optional "s + type_name<typename RawType::value_type>();
     if (is_non_string_container_v<RawType>)
         return "repeated thing"s;
-    if (std::is_same_v<RawType, std::string>)
+    if (is_string_v<RawType> || std::is_same_v<RawType, std::string_view>)
         return "string"s;
+    if (std::is_same_v<RawType, std::span<const std::byte>>)
+        return "bytes"s;
     if (std::is_same_v<RawType, bool>)
         return "bool"s;
     if (std::is_integral_v<RawType> && (sizeof(RawType)<=4))
@@ -296,6 +717,12 @@ inline std::string type_as_string(T p)
     return "thing"s;
 }
 
+template<class PS, class T>
+inline std::string type_as_string(T p)
+{
+    return type_name<std::remove_const_t<std::remove_reference_t<decltype(std::declval<PS>().*p)>>>();
+}
+
 template<EnumeratedType ET>
 inline std::string to_schema()
 {
@@ -331,135 +758,581 @@ inline std::string to_schema()
 }
 
 // readers
+// each returns the rest of data, or what was wrong with it, see ParseResult.h
 
-ConstDataBlock operator>>(ConstDataBlock data, uint64_t& tgt)
+inline ParseResult operator>>(ConstDataBlock data, uint64_t& tgt)
 {
-    std::byte next;
-    int offset{0};
-    tgt = 0;
-    do
-    {
-        data = data>>next;
-        tgt |= ((uint64_t)next&0x7F)<<offset;
-        offset += 7;
-    } while ((bool)(std::byte{0x80}&next));
-    return data;
+    const auto used = DecodeVarint(data.data(), data.size(), tgt);
+    if (!used)
+        return ParseResult::failure(data.size() < 10 ? ParseError::TRUNCATED : ParseError::BAD_VARINT, data);
+    return data.subspan(used);
+}
+
+// splits a length prefixed payload off the front of data
+inline ParseResult SplitDelimited(ConstDataBlock data, ConstDataBlock& payload)
+{
+    std::uint64_t size;
+    const auto res = data >> size;
+    if (!res)
+        return res;
+    const auto rest = res.rest();
+    if (size > rest.size())
+        return ParseResult::failure(ParseError::BAD_LENGTH, data);
+    payload = rest.first(size);
+    return rest.subspan(size);
 }
 
 template<Numerical T>
-ConstDataBlock operator>>(ConstDataBlock data, T& tgt)
+ParseResult operator>>(ConstDataBlock data, T& tgt)
 {
     uint64_t tmp;
-    data = data >> tmp;
-    tgt = static_cast<T>(tmp);
-    return data;
+    const auto res = data >> tmp;
+    if (res)
+        tgt = static_cast<T>(tmp);
+    return res;
 }
 
 template<EnumType T>
-ConstDataBlock operator>>(ConstDataBlock data, T& tgt)
+ParseResult operator>>(ConstDataBlock data, T& tgt)
 {
     return data >> reinterpret_cast<std::underlying_type_t<T>&>(tgt);    // write as if it was the underlying type
 }
 
 template<class T>
-ConstDataBlock operator>>(ConstDataBlock data, SignedInt<T>& tgt)
+ParseResult operator>>(ConstDataBlock data, SignedInt<T>& tgt)
 {
+    uint64_t wire_val;
+    const auto res = data >> wire_val;
+    if (!res)
+        return res;
     if constexpr (sizeof(T)<=4)
+        tgt = static_cast<T>(ZigZagDecode32(static_cast<std::uint32_t>(wire_val)));
+    else
+        tgt = static_cast<T>(ZigZagDecode64(wire_val));
+    return res;
+}
+
+
+template<class T>
+inline ParseResult ReadAsFixed(ConstDataBlock data, T& tgt)
+{
+    using wire_type = std::conditional_t<OnWireType<T>()==WireType::FIXED32, std::uint32_t, std::uint64_t>;
+    if (data.size() < sizeof(wire_type))
+        return ParseResult::failure(ParseError::TRUNCATED, data);
+    wire_type val;
+    if constexpr (sizeof(val)==4)
+        val = load_le32(data.data());
+    else
+        val = load_le64(data.data());
+    if constexpr (std::is_floating_point_v<T>)
+        tgt = std::bit_cast<T>(val);
+    else if constexpr (requires { typename T::value_type; })
+        tgt = static_cast<typename T::value_type>(val);
+    else
+        tgt = static_cast<T>(val);
+    return data.subspan(sizeof(val));
+}
+
+template<class T>
+inline ParseResult operator>>(ConstDataBlock data, FixedInt<T>& tgt)
+{
+    return ReadAsFixed(data, tgt);
+}
+
+inline ParseResult operator>>(ConstDataBlock data, float& tgt)
+{
+    return ReadAsFixed(data, tgt);
+}
+
+inline ParseResult operator>>(ConstDataBlock data, double& tgt)
+{
+    return ReadAsFixed(data, tgt);
+}
+
+// number of values in a packed run
+template<class T>
+inline std::size_t PackedCount(ConstDataBlock run)
+{
+    if constexpr (OnWireType<T>()==WireType::FIXED32)
+        return run.size()/4;
+    else if constexpr (OnWireType<T>()==WireType::FIXED64)
+        return run.size()/8;
+    else    // every varint ends in exactly one byte with the top bit clear
+        return std::count_if(run.begin(), run.end(), [](std::byte b){ return (b&std::byte{0x80})==std::byte{0}; });
+}
+
+template<NonStringContainer C>
+ParseResult ReadPacked(ConstDataBlock data, C& tgt)
+{
+    using T = typename C::value_type;
+    ConstDataBlock run;
+    const auto res = SplitDelimited(data, run);
+    if (!res)
+        return res;
+    const auto count = PackedCount<T>(run);
+    if constexpr (OnWireType<T>()!=WireType::VARINT)
     {
-        uint64_t wire_val;
-        data = data >> wire_val;
-        tgt = (wire_val&1) ? -(T)(wire_val>>1)-1 : (T)(wire_val>>1);
+        if (run.size() != count*(OnWireType<T>()==WireType::FIXED32 ? 4 : 8))
+            return ParseResult::failure(ParseError::BAD_LENGTH, data);
     }
-    else
+    if constexpr (is_bulk_fixed_v<C>)
     {
-        uint64_t wire_val;
-        data = data >> wire_val;
-        tgt = (wire_val&1) ? -(T)(wire_val>>1)-1 : (T)(wire_val>>1);
+        if (count)  // an empty run has no data to copy from
+        {
+            const auto old_size = tgt.size();
+            tgt.resize(old_size + count);
+            std::memcpy(tgt.data()+old_size, run.data(), count*sizeof(T));
+        }
+        return res;
     }
-    return data;
+    if constexpr (requires(C c, std::size_t n) { c.reserve(n); })
+    {
+        InstrumentAllocation(tgt.size()+count > tgt.capacity());
+        tgt.reserve(tgt.size() + count);
+    }
+    while (!run.empty())
+    {
+        T elem{};
+        const auto next = run >> elem;
+        if (!next)
+            return next;    // a varint cut short by the end of the run
+        run = next.rest();
+        tgt.push_back(elem);
+    }
+    return res;
 }
 
+template<class Traits, class Alloc>
+inline ParseResult operator>>(ConstDataBlock data, std::basic_string<char, Traits, Alloc>& tgt)
+{
+    ConstDataBlock bytes;
+    const auto res = SplitDelimited(data, bytes);
+    if (!res)
+        return res;
+    InstrumentAllocation(bytes.size() > tgt.capacity());
+    tgt.assign(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+    return res;
+}
 
-ConstDataBlock operator>>(ConstDataBlock data, std::string& tgt)
+// Borrowed fields: the view is set to point into data, nothing is copied.
+// It is only valid while the buffer that was parsed is alive and unmodified. Parsing a message
+// that has borrowed fields from a temporary DataBlock does not compile, see below.
+inline ParseResult operator>>(ConstDataBlock data, std::string_view& tgt)
 {
-    int size;
-    data = data >> size;
-    tgt.clear();
-    for (int i=0; i < size; ++i)
+    ConstDataBlock bytes;
+    const auto res = SplitDelimited(data, bytes);
+    if (res)
+        tgt = std::string_view{reinterpret_cast<const char*>(bytes.data()), bytes.size()};
+    return res;
+}
+
+inline ParseResult operator>>(ConstDataBlock data, std::span<const std::byte>& tgt)
+{
+    ConstDataBlock bytes;
+    const auto res = SplitDelimited(data, bytes);
+    if (res)
+        tgt = bytes;
+    return res;
+}
+
+// Allocators
+// Strings and containers with a std::pmr allocator are supported. To have a whole decoded message allocate from
+// one memory resource (a std::pmr::monotonic_buffer_resource, say), call AllocateFrom on the empty message before
+// parsing into it: each new element the reader adds to a pmr container then allocates from the container's
+// resource too, including the strings and containers of an element that is itself a message.
+template<class T> concept PmrAware = requires { typename T::allocator_type; typename T::value_type; } &&
+    std::is_same_v<typename T::allocator_type, std::pmr::polymorphic_allocator<typename T::value_type>>;
+
+// makes the pmr strings and containers of obj, at any depth, allocate from resource
+// meant for a new message, anything already held is copied into the resource
+template<ProtoStruct PS>
+inline void AllocateFrom(PS& obj, std::pmr::memory_resource* resource)
+{
+    proto_visit_indexed(obj, [resource](auto& mbr, auto)
+		{
+            using this_type = std::remove_reference_t<decltype(mbr)>;
+            if constexpr (is_embedded_v<this_type>)
+                AllocateFrom(EmbeddedMessage(mbr), resource);
+            else if constexpr (PmrAware<this_type>)
+            {
+                if (mbr.get_allocator().resource() != resource)
+                {
+                    this_type rebound(std::move(mbr), typename this_type::allocator_type{resource});
+                    std::destroy_at(&mbr);
+                    std::construct_at(&mbr, std::move(rebound));
+                }
+                if constexpr (is_non_string_container_v<this_type>)
+                {
+                    if constexpr (is_embedded_v<typename this_type::value_type>)
+                        for (auto& elem : mbr)
+                            AllocateFrom(EmbeddedMessage(elem), resource);
+                }
+            }
+		});
+}
+
+// a new, empty element for tgt, allocating from the same resource as tgt if it has one
+template<NonStringContainer C>
+inline typename C::value_type NewElement(const C& tgt)
+{
+    using T = typename C::value_type;
+    if constexpr (PmrAware<C> && is_embedded_v<T>)
     {
-        std::byte c;
-        data = data >> c;
-        tgt.push_back((char)c);
+        T elem{};
+        AllocateFrom(EmbeddedMessage(elem), tgt.get_allocator().resource());
+        return elem;
     }
-    return data;
+    else if constexpr (PmrAware<C> && PmrAware<T>)
+        return T(typename T::allocator_type{tgt.get_allocator().resource()});
+    else
+        return T{};
+}
+
+// reads one value of a field, an embedded message is length prefixed like a string
+template<class T>
+inline ParseResult ReadValue(ConstDataBlock data, T& tgt)
+{
+    if constexpr (is_embedded_v<T>)
+    {
+        ConstDataBlock payload;
+        const auto res = SplitDelimited(data, payload);
+        if (!res)
+            return res;
+        const auto inner = payload >> tgt;
+        return inner ? res : inner;
+    }
+    else
+        return data >> tgt;
 }
 
 template<NonStringContainer C>
-ConstDataBlock operator>>(ConstDataBlock data, C& tgt)
+ParseResult operator>>(ConstDataBlock data, C& tgt)
 {
     using T = typename std::remove_reference_t<C>::value_type; 
-    T new_elem{};
-    if constexpr (is_proto_struct_v<T>) // embeded object are treated like strings
-    {
-        int size;
-        data = data >> size;
-        const auto obj_data = data.first(size);
-        const auto unused_data = obj_data >> new_elem;
-        assert(unused_data.size()==0);
-        tgt.push_back(new_elem);
-        return data.subspan(size);
+    T new_elem = NewElement(tgt);
+    if constexpr (requires { tgt.capacity(); })
+        InstrumentAllocation(tgt.size()==tgt.capacity());
+    const auto res = ReadValue(data, new_elem);   // embeded object are treated like strings
+    if (res)
+        tgt.push_back(std::move(new_elem));
+    return res;
+}
+
+// one field of an encoded message, the payload of a DELIMITED field excludes its length
+struct RawField
+{
+    FieldID id{0};
+    WireType type{WireType::VARINT};
+    ConstDataBlock payload;
+};
+
+// field numbers run from 1 to 2^29-1
+constexpr FieldID max_field_number{(1 << 29) - 1};
+
+constexpr bool ValidFieldNumber(std::uint64_t number)
+{
+    return number != 0 && number <= static_cast<std::uint64_t>(max_field_number);
+}
+
+// reads the tag at the front of data
+inline ParseResult ReadTag(ConstDataBlock data, FieldID& id, WireType& type)
+{
+    std::uint64_t id_and_type;
+    const auto res = data >> id_and_type;
+    if (!res)
+        return res;
+    if (!ValidFieldNumber(id_and_type >> 3))
+        return ParseResult::failure(ParseError::BAD_FIELD_NUMBER, data);
+    id = static_cast<FieldID>(id_and_type >> 3);
+    type = static_cast<WireType>(id_and_type&7);
+    return res;
+}
+
+// splits the payload of a field of the given wire type off the front of data
+// (wire types 3 and 4, the proto2 groups, are not supported and are a BAD_WIRE_TYPE error)
+inline ParseResult SplitPayload(ConstDataBlock data, WireType type, ConstDataBlock& payload)
+{
+    switch (type)
+    {
+        case WireType::VARINT:
+        {
+            std::uint64_t ignored;
+            const auto res = data >> ignored;
+            if (res)
+                payload = data.first(data.size()-res.rest().size());
+            return res;
+        }
+        case WireType::FIXED32:
+        case WireType::FIXED64:
+        {
+            const std::size_t size = type==WireType::FIXED32 ? 4 : 8;
+            if (data.size() < size)
+                return ParseResult::failure(ParseError::TRUNCATED, data);
+            payload = data.first(size);
+            return data.subspan(size);
+        }
+        case WireType::DELIMITED:
+            return SplitDelimited(data, payload);
+    }
+    return ParseResult::failure(ParseError::BAD_WIRE_TYPE, data);
+}
+
+// steps over the payload of a field without decoding it
+inline ParseResult SkipField(ConstDataBlock data, WireType type)
+{
+    ConstDataBlock ignored;
+    return SplitPayload(data, type, ignored);
+}
+
+// reads the next tag and payload from data, data must not be empty
+inline ParseResult ReadRawField(ConstDataBlock data, RawField& field)
+{
+    const auto res = ReadTag(data, field.id, field.type);
+    if (!res)
+        return res;
+    return SplitPayload(res.rest(), field.type, field.payload);
+}
+
+// reads member I of tgt, the tag has already been consumed
+// a field whose wire type does not match its member is an error, rather than being misread
+template<ProtoStruct PS, std::size_t I>
+inline ParseResult ReadMember(ConstDataBlock data, WireType type, PS& tgt)
+{
+    auto& mbr = tgt.*(proto_member<PS, I>.pointer);
+    using T = std::remove_reference_t<decltype(mbr)>;
+    if constexpr (is_non_string_container_v<T>)
+    {
+        if constexpr (is_packable_v<typename T::value_type>)
+        {
+            if (type == WireType::DELIMITED)    // packed, but a single unpacked value is also valid
+                return ReadPacked(data, mbr);
+        }
+        if (type != OnWireType<typename T::value_type>())
+            return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+        return data >> mbr;
     }
     else
     {
-        const auto unused_data = data >> new_elem;
-        tgt.push_back(new_elem);
-        return unused_data;
+        if (type != OnWireType<T>())
+            return ParseResult::failure(ParseError::WRONG_WIRE_TYPE, data);
+        if constexpr (is_optional_v<T>)
+        {
+            if (!mbr.has_value())
+                mbr.emplace();
+            return ReadValue(data, *mbr);
+        }
+        else
+            return ReadValue(data, mbr);
     }
 }
 
+// maps a field number to its position in get_members(), built at compile time
+// Field numbers up to a few times the member count get a directly indexed table. Sparser numbering uses the
+// smallest modulus that puts every field number in its own slot, and a sorted search if there is none.
 template<ProtoStruct PS>
-ConstDataBlock operator>>(ConstDataBlock data, PS& tgt)
+class FieldDispatch
 {
-    using ReadFn = std::function<ConstDataBlock(ConstDataBlock, WireType)>;
-    std::map<int, ReadFn> member_map;
-    proto_enumerate(tgt, overloaded{
-    [&member_map](auto& tgt, int id, auto )
+    using Index = std::uint16_t;
+    static constexpr std::size_t count = proto_member_count<PS>;
+
+    static constexpr auto field_numbers()
+    {
+        return [] <std::size_t... Is>(std::index_sequence<Is...>)
+        {
+            return std::array<FieldID, count>{ proto_member<PS, Is>.field_num... };
+        }(std::make_index_sequence<count>{});
+    }
+    static constexpr auto fields = field_numbers();
+    static constexpr FieldID max_field = count ? *std::max_element(fields.begin(), fields.end()) : 0;
+
+    static constexpr bool is_dense = max_field < 256 || static_cast<std::size_t>(max_field) < 8*count;
+
+    static constexpr bool is_perfect(std::size_t modulus)
     {
-        member_map[id] = [&tgt](ConstDataBlock data, WireType type){ return data >> tgt;};
-    },
-    [&member_map]<NonStringContainer T>(T& tgt, int id, auto )
+        std::array<bool, 4*count+64> used{};
+        for (const auto f : fields)
+        {
+            if (used[f%modulus])
+                return false;
+            used[f%modulus] = true;
+        }
+        return true;
+    }
+    static constexpr std::size_t find_modulus()
     {
-        member_map[id] = [&tgt](ConstDataBlock data, WireType type){ 
-            assert/*if*/ (type == WireType::DELIMITED);
-            return data >> tgt;;
-        };
-    },
-    [&member_map]<ProtoStruct T>(T& tgt, int id, auto )
-    {
-        member_map[id] = [&tgt](ConstDataBlock data, WireType type){ 
-            assert/*if*/ (type == WireType::DELIMITED);
-            int size;
-            data = data >> size;
-            const auto obj_data = data.first(size);
-            const auto unused_data = obj_data >> tgt;
-            assert(unused_data.size()==0);
-            return data.subspan(size);
-        };
+        for (std::size_t modulus = count; !is_dense && modulus < 4*count+64; ++modulus)
+            if (is_perfect(modulus))
+                return modulus;
+        return 0;
+    }
+    static constexpr std::size_t modulus = find_modulus();
+
+    static constexpr auto make_table()
+    {
+        constexpr std::size_t size = is_dense ? max_field+1 : (modulus ? modulus : 1);
+        std::array<Index, size> table{};
+        table.fill(count);
+        for (std::size_t idx = count; idx-- > 0;)   // backwards, so the first of any duplicate wins
+            table[is_dense ? fields[idx] : (modulus ? fields[idx]%modulus : 0)] = idx;
+        return table;
     }
-    });
-    while (!data.empty())
-    {
-        // is this a byte? or a varint?
-        std::byte id_and_type{std::byte{0xFF}};
-        data = data >> id_and_type;
-        const auto id = static_cast<int>(id_and_type >> 3);
-        const WireType type = static_cast<WireType>(id_and_type&std::byte{7});
-        const auto found = member_map.find(id);
-        if (member_map.end()!=found)
-            data = found->second(data, type);
+    static constexpr auto table = make_table();
+
+    static constexpr auto make_sorted()
+    {
+        std::array<std::pair<FieldID, Index>, count> sorted{};
+        for (std::size_t idx = 0; idx < count; ++idx)
+            sorted[idx] = {fields[idx], idx};
+        std::sort(sorted.begin(), sorted.end());
+        return sorted;
+    }
+    static constexpr auto sorted = make_sorted();
+
+public:
+    // position of the member with field number id, or proto_member_count<PS> if there is none
+    static constexpr std::size_t find(FieldID id)
+    {
+        if constexpr (is_dense)
+            return (id >= 0 && id <= max_field) ? table[id] : count;
+        else if constexpr (modulus != 0)
+        {
+            const auto idx = table[static_cast<std::size_t>(id)%modulus];
+            return (idx < count && fields[idx]==id) ? idx : count;
+        }
         else
-            std::cerr << "cannot find index:" << id << "\n";
-            
+        {
+            const auto found = std::lower_bound(sorted.begin(), sorted.end(), std::pair<FieldID, Index>{id, 0});
+            return (found != sorted.end() && found->first==id) ? found->second : count;
+        }
     }
-    return data;
-}
\ No newline at end of file
+};
+
+// Fields usually arrive in the order they are written (write_order), so after a member the parser first checks
+// for the tag of the member expected next, one compare against its encoded bytes, and only decodes the tag and
+// looks it up when that fails. A repeated field written element by element is expected again.
+template<ProtoStruct PS>
+struct FieldPrediction
+{
+    static constexpr std::size_t count = proto_member_count<PS>;
+
+    // the encoded tag of each member
+    static constexpr auto tags = [] <std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        return std::array<EncodedTag, count>{ member_tag<PS, Is>... };
+    }(std::make_index_sequence<count>{});
+
+    // the member expected first, and after each member (count for none)
+    static constexpr std::size_t first = count ? write_order<PS>[0] : 0;
+    static constexpr auto next = [] <std::size_t... Is>(std::index_sequence<Is...>)
+    {
+        constexpr auto repeats = [] <std::size_t I>(std::integral_constant<std::size_t, I>)
+        {
+            using T = std::remove_cvref_t<decltype(std::declval<PS&>().*(proto_member<PS, I>.pointer))>;
+            if constexpr (is_non_string_container_v<T>)
+                return !is_packable_v<typename T::value_type>;
+            else
+                return false;
+        };
+        std::array<std::size_t, count> res{};
+        for (std::size_t pos = 0; pos < count; ++pos)
+            res[write_order<PS>[pos]] = pos+1 < count ? write_order<PS>[pos+1] : count;
+        ((res[Is] = repeats(std::integral_constant<std::size_t, Is>{}) ? Is : res[Is]), ...);
+        return res;
+    }(std::make_index_sequence<count>{});
+};
+
+// true if data starts with the bytes of tag
+inline bool StartsWithTag(ConstDataBlock data, const EncodedTag& tag)
+{
+    if (data.size() >= 8)
+        return (load_le64(data.data()) & (~std::uint64_t{0} >> (64-8*tag.size))) == tag.raw;
+    return data.size() >= tag.size && std::memcmp(data.data(), tag.bytes.data(), tag.size) == 0;
+}
+
+// a switch over the member position, the compiler can inline every reader
+template<ProtoStruct PS, std::size_t... Is>
+inline ParseResult ReadMemberAt(std::size_t idx, ConstDataBlock data, WireType type, PS& tgt, std::index_sequence<Is...>)
+{
+    ParseResult res{data};
+    ((idx==Is && (res = ReadMember<PS, Is>(data, type, tgt), true)) || ...);
+    return res;
+}
+
+template<ProtoStruct PS>
+ParseResult operator>>(ConstDataBlock data, PS& tgt)
+{
+    if constexpr (table_driven_v<PS>)
+        return TableReadMessage(data, tgt);
+    else
+    {
+        constexpr auto count = proto_member_count<PS>;
+        using Prediction = FieldPrediction<PS>;
+        auto scope = InstrumentDecode<PS>();
+        const auto start_size = data.size();
+        std::size_t expected{Prediction::first};
+        while (!data.empty())
+        {
+            const auto field_start = data;
+            std::size_t idx;
+            WireType type;
+            if (expected < count && StartsWithTag(data, Prediction::tags[expected]))
+            {
+                idx = expected;
+                type = static_cast<WireType>(Prediction::tags[idx].value&7);
+                data = data.subspan(Prediction::tags[idx].size);
+            }
+            else
+            {
+                FieldID id;
+                const auto tag = ReadTag(data, id, type);
+                if (!tag)
+                    return tag;
+                data = tag.rest();
+                idx = FieldDispatch<PS>::find(id);
+            }
+            if (idx < count)
+            {
+                const auto res = ReadMemberAt(idx, data, type, tgt, std::make_index_sequence<count>{});
+                if (!res)
+                    return res;
+                data = res.rest();
+                scope.field(idx, field_start.size()-data.size());
+                expected = Prediction::next[idx];
+            }
+            else
+            {
+                const auto res = SkipField(data, type);
+                if (!res)
+                    return res;
+                data = res.rest();
+                if constexpr (KeepsUnknownFields<PS>)
+                    tgt.unknown_fields.append(field_start.first(field_start.size()-data.size()));
+            }
+        }
+        scope.finish(start_size);
+        return data;
+    }
+}
+
+// true if any field of T, at any depth, borrows from the parsed buffer
+template<class T>
+constexpr bool borrows_input()
+{
+    if constexpr (is_borrowed_v<T>)
+        return true;
+    else if constexpr (is_non_string_container_v<T> || is_optional_v<T>)
+        return borrows_input<typename T::value_type>();
+    else if constexpr (is_proto_struct_v<T>)
+        return [] <std::size_t... Is>(std::index_sequence<Is...>)
+        {
+            return (borrows_input<std::remove_cvref_t<decltype(std::declval<T&>().*(proto_member<T, Is>.pointer))>>() || ...);
+        }(std::make_index_sequence<proto_member_count<T>>{});
+    else
+        return false;
+}
+
+// borrowed fields would dangle as soon as the temporary buffer is destroyed
+template<ProtoStruct PS> requires (borrows_input<PS>())
+ParseResult operator>>(DataBlock&& data, PS& tgt) = delete;
+
+#include "TableDriven.h"
@@ -0,0 +1,484 @@
+// Benchmark module
+// TinyPBBench [--quick] [--csv]
+// --quick runs small corpora once (a smoke test, as run by ctest), --csv prints one line per result for tooling
+#include "protobuf.h"
+#include "Reuse.h"
+#include "Cached.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// keeps results alive so the optimiser cannot drop the work
+static std::uint64_t checksum{0};
+static bool quick{false};
+static bool csv{false};
+
+// every heap allocation in the process is counted
+// the whole set of replaceable allocation functions is replaced, so that aligned and nothrow allocations are counted
+// too and every pointer is released by the deallocation that matches its allocation
+static std::atomic<std::size_t> allocations{0};
+
+static void* counted_alloc(std::size_t size, std::size_t align) noexcept
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    if (align <= alignof(std::max_align_t))
+        return std::malloc(size);
+    return std::aligned_alloc(align, (size+align-1) & ~(align-1));    // a whole number of alignments
+}
+
+static void* counted_alloc_or_throw(std::size_t size, std::size_t align)
+{
+    if (void* ptr = counted_alloc(size, align))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+static void counted_free(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+constexpr auto default_align = alignof(std::max_align_t);
+
+void* operator new(std::size_t size) { return counted_alloc_or_throw(size, default_align); }
+void* operator new[](std::size_t size) { return counted_alloc_or_throw(size, default_align); }
+void* operator new(std::size_t size, std::align_val_t align) { return counted_alloc_or_throw(size, static_cast<std::size_t>(align)); }
+void* operator new[](std::size_t size, std::align_val_t align) { return counted_alloc_or_throw(size, static_cast<std::size_t>(align)); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, default_align); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size, default_align); }
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return counted_alloc(size, static_cast<std::size_t>(align)); }
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return counted_alloc(size, static_cast<std::size_t>(align)); }
+
+void operator delete(void* ptr) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::size_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(ptr); }
+
+template<class Fn>
+double seconds_for(Fn&& fn, int repeats)
+{
+    fn();   // warm up
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeats; ++i)
+        fn();
+    const auto stop = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(stop-start).count();
+}
+
+// reference byte-at-a-time codec, the loop the kernels replaced
+inline std::size_t EncodeVarintByteLoop(std::uint64_t val, std::byte* tgt)
+{
+    std::size_t size{0};
+    do
+    {
+        std::byte next = static_cast<std::byte>(val)&std::byte{0x7F};
+        val >>= 7;
+        if (val)
+            next |= std::byte{0x80};
+        tgt[size++] = next;
+    } while (val);
+    return size;
+}
+
+inline std::size_t DecodeVarintByteLoop(const std::byte* src, std::size_t, std::uint64_t& tgt)
+{
+    std::size_t size{0};
+    int offset{0};
+    tgt = 0;
+    std::byte next;
+    do
+    {
+        next = src[size++];
+        tgt |= ((uint64_t)next&0x7F)<<offset;
+        offset += 7;
+    } while ((bool)(std::byte{0x80}&next));
+    return size;
+}
+
+template<class Encode, class Decode>
+void bench_varint_codec(const char* name, const char* codec, const std::vector<std::uint64_t>& values, Encode encode, Decode decode)
+{
+    const int repeats{quick ? 1 : 20};
+    DataBlock buffer(values.size()*10 + 16);
+    std::size_t used{0};
+    const auto enc = seconds_for([&]{
+        used = 0;
+        for (const auto v : values)
+            used += encode(v, buffer.data()+used);
+        checksum += used;
+    }, repeats);
+    const auto dec = seconds_for([&]{
+        std::size_t pos{0};
+        std::uint64_t sum{0};
+        while (pos < used)
+        {
+            std::uint64_t v;
+            pos += decode(buffer.data()+pos, buffer.size()-pos, v);
+            sum += v;
+        }
+        checksum += sum;
+    }, repeats);
+    const auto per_value = 1e9/(values.size()*repeats);
+    if (csv)
+        std::printf("varint,%s,%s,%.3f,%.3f\n", name, codec, enc*per_value, dec*per_value);
+    else
+        std::printf("%-28s %-10s encode %6.2f ns/value   decode %6.2f ns/value\n", name, codec, enc*per_value, dec*per_value);
+}
+
+void bench_varint(const char* name, const std::vector<std::uint64_t>& values)
+{
+    bench_varint_codec(name, "byte loop", values, EncodeVarintByteLoop, DecodeVarintByteLoop);
+    bench_varint_codec(name, "kernel", values, EncodeVarint, DecodeVarint);
+}
+
+template<class Gen>
+std::vector<std::uint64_t> make_values(std::size_t count, Gen&& gen)
+{
+    std::vector<std::uint64_t> values(count);
+    for (auto& v : values)
+        v = gen();
+    return values;
+}
+
+void varint_benchmarks()
+{
+    const std::size_t count{quick ? 10'000u : 1'000'000u};
+    std::mt19937_64 rng{1};
+    if (!csv)
+    {
+#ifdef TINYPB_VARINT_BMI2
+        std::printf("varint kernels: BMI2\n");
+#else
+        std::printf("varint kernels: portable\n");
+#endif
+    }
+    bench_varint("1 byte", make_values(count, [&]{ return rng() & 0x7F; }));
+    bench_varint("2 bytes", make_values(count, [&]{ return (rng() & 0x3FFF) | 0x80; }));
+    bench_varint("1-5 bytes, uniform width", make_values(count, [&]{ return rng() >> (29 + rng()%35); }));
+    bench_varint("1-10 bytes, uniform width", make_values(count, [&]{ return rng() >> (rng()%64); }));
+    bench_varint("negative int32 (10 bytes)", make_values(count, [&]{ return static_cast<std::uint64_t>(-static_cast<std::int64_t>(rng()%1000) - 1); }));
+    bench_varint("zigzag small +/-", make_values(count, [&]{ return ZigZagEncode64(static_cast<std::int64_t>(rng()%2001) - 1000); }));
+}
+
+// Message corpora
+// Generated from a fixed seed, so every run (and every release) measures the same bytes.
+
+// string heavy: a few long strings and a list of short ones
+struct Article {
+    std::string title;
+    std::string author;
+    std::string body;
+    std::string url;
+    std::vector<std::string> tags;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Article, 1, title),
+                PROTODECL(Article, 2, author),
+                PROTODECL(Article, 3, body),
+                PROTODECL(Article, 4, url),
+                PROTODECL(Article, 5, tags)
+        );
+    }
+};
+
+// numeric heavy: every kind of scalar, and packed runs
+struct Sample {
+    int32_t id;
+    int64_t stamp;
+    SignedInt<int32_t> delta;
+    SignedInt<int64_t> offset;
+    FixedInt<uint32_t> crc;
+    double value;
+    float ratio;
+    bool ok;
+    std::vector<int32_t> counts;
+    std::vector<double> series;
+    std::vector<SignedInt<int64_t>> moves;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Sample, 1, id),
+                PROTODECL(Sample, 2, stamp),
+                PROTODECL(Sample, 3, delta),
+                PROTODECL(Sample, 4, offset),
+                PROTODECL(Sample, 5, crc),
+                PROTODECL(Sample, 6, value),
+                PROTODECL(Sample, 7, ratio),
+                PROTODECL(Sample, 8, ok),
+                PROTODECL(Sample, 9, counts),
+                PROTODECL(Sample, 10, series),
+                PROTODECL(Sample, 11, moves)
+        );
+    }
+};
+
+// deeply nested: a chain of embedded messages
+template<int Depth>
+struct Node {
+    int32_t value;
+    std::string label;
+    Node<Depth-1> child;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Node, 1, value),
+                PROTODECL(Node, 2, label),
+                PROTODECL(Node, 3, child)
+        );
+    }
+};
+template<>
+struct Node<0> {
+    int32_t value;
+    std::string label;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Node, 1, value),
+                PROTODECL(Node, 2, label)
+        );
+    }
+};
+using Deep = Node<12>;
+
+// wide repeated: the AddressBook of the tests, with many people in it
+struct Timestamp {
+    int64_t seconds;
+    int32_t nanos;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Timestamp, 1, seconds),
+                PROTODECL(Timestamp, 2, nanos)
+        );
+    }
+};
+struct Person {
+    std::string name;
+    int32_t id;
+    std::string email;
+    enum class PhoneType {
+        MOBILE,
+        HOME,
+        WORK,
+        NUM_ENUMS
+    };
+    struct PhoneNumber {
+        std::string number;
+        PhoneType type;
+        static constexpr auto get_members() {
+            return std::make_tuple(
+                    PROTODECL(PhoneNumber, 1, number),
+                    PROTODECL(PhoneNumber, 2, type)
+            );
+        }
+    };
+    std::vector<PhoneNumber> phones;
+    Timestamp last_updated;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Person, 1, name),
+                PROTODECL(Person, 2, id),
+                PROTODECL(Person, 3, email),
+                PROTODECL(Person, 4, phones),
+                PROTODECL(Person, 5, last_updated)
+        );
+    }
+};
+struct AddressBook {
+    std::vector<Person> people;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(AddressBook, 1, people)
+        );
+    }
+};
+
+// the same, with each person kept with its encoding, as if most are unchanged between sends
+struct CachedAddressBook {
+    std::vector<Cached<Person>> people;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(CachedAddressBook, 1, people)
+        );
+    }
+};
+
+std::string random_text(std::mt19937_64& rng, std::size_t min, std::size_t max)
+{
+    std::string text(min + rng()%(max-min+1), ' ');
+    for (auto& c : text)
+        c = static_cast<char>('a' + rng()%26);
+    return text;
+}
+
+Article make_article(std::mt19937_64& rng)
+{
+    Article article{random_text(rng, 20, 80), random_text(rng, 5, 30), random_text(rng, 500, 4000), random_text(rng, 30, 120)};
+    for (auto tags = rng()%10; tags > 0; --tags)
+        article.tags.push_back(random_text(rng, 3, 12));
+    return article;
+}
+
+Sample make_sample(std::mt19937_64& rng)
+{
+    Sample sample{static_cast<int32_t>(rng()%100000), static_cast<int64_t>(rng() >> 20),
+                  static_cast<int32_t>(rng()%2001) - 1000, static_cast<int64_t>(rng()) >> (rng()%60),
+                  static_cast<uint32_t>(rng()), static_cast<double>(rng()%100000)/7.0,
+                  static_cast<float>(rng()%1000)/3.0f, (rng()&1) != 0};
+    for (auto count = 16 + rng()%48; count > 0; --count)
+    {
+        sample.counts.push_back(static_cast<int32_t>(rng() >> (rng()%64)));
+        sample.series.push_back(static_cast<double>(rng()%1000000)/1000.0);
+        sample.moves.push_back(static_cast<int64_t>(rng()%20001) - 10000);
+    }
+    return sample;
+}
+
+template<int Depth>
+void fill_node(Node<Depth>& node, std::mt19937_64& rng)
+{
+    node.value = static_cast<int32_t>(rng()%1000);
+    node.label = random_text(rng, 4, 16);
+    if constexpr (Depth > 0)
+        fill_node(node.child, rng);
+}
+
+Deep make_deep(std::mt19937_64& rng)
+{
+    Deep deep{};
+    fill_node(deep, rng);
+    return deep;
+}
+
+AddressBook make_address_book(std::mt19937_64& rng, std::size_t people)
+{
+    AddressBook book;
+    for (std::size_t idx = 0; idx < people; ++idx)
+    {
+        Person person{random_text(rng, 5, 20), static_cast<int32_t>(idx), random_text(rng, 10, 30) + "@example.com"};
+        for (auto phones = 1 + rng()%3; phones > 0; --phones)
+            person.phones.push_back({std::to_string(rng()%10000000000), static_cast<Person::PhoneType>(rng()%3)});
+        person.last_updated = {static_cast<int64_t>(1600000000 + rng()%100000000), static_cast<int32_t>(rng()%1000000000)};
+        book.people.push_back(std::move(person));
+    }
+    return book;
+}
+
+// stops the optimiser from dropping the work that produced obj, without touching it
+template<class T>
+inline void keep(const T& obj)
+{
+    asm volatile("" : : "r"(&obj) : "memory");
+}
+
+// encode, decode into a new object, and decode into one reused object
+template<ProtoStruct PS>
+void bench_messages(const char* corpus, const std::vector<PS>& msgs)
+{
+    const int repeats{quick ? 1 : 10};
+    std::vector<DataBlock> encoded(msgs.size());
+    std::size_t bytes{0};
+    for (std::size_t idx = 0; idx < msgs.size(); ++idx)
+    {
+        encoded[idx] << msgs[idx];
+        bytes += encoded[idx].size();
+    }
+
+    const auto run = [&](const char* what, auto&& fn)
+    {
+        const auto before = allocations.load();
+        const auto seconds = seconds_for(fn, repeats);
+        // the warm up run is timed out but its allocations are counted
+        const auto allocs_per_msg = static_cast<double>(allocations.load()-before)/(msgs.size()*(repeats+1));
+        const auto mb_per_s = bytes*repeats/seconds/1e6;
+        const auto msgs_per_s = msgs.size()*repeats/seconds;
+        if (csv)
+            std::printf("message,%s,%s,%.1f,%.0f,%.3f\n", corpus, what, mb_per_s, msgs_per_s, allocs_per_msg);
+        else
+            std::printf("%-22s %-14s %9.1f MB/s %12.0f msgs/s %8.2f allocs/msg\n", corpus, what, mb_per_s, msgs_per_s, allocs_per_msg);
+    };
+
+    DataBlock buffer;
+    run("encode", [&]{
+        for (const auto& msg : msgs)
+        {
+            buffer.clear();
+            buffer << msg;
+            checksum += buffer.size();
+        }
+    });
+    run("decode", [&]{
+        for (const auto& data : encoded)
+        {
+            PS msg{};
+            as_const(data) >> msg;
+            keep(msg);
+        }
+    });
+    PS reused{};
+    run("decode reusing", [&]{
+        for (const auto& data : encoded)
+        {
+            ReadReusing(as_const(data), reused);
+            keep(reused);
+        }
+    });
+}
+
+template<class Make>
+auto make_corpus(std::size_t count, Make&& make)
+{
+    std::vector<decltype(make())> corpus;
+    corpus.reserve(count);
+    for (std::size_t idx = 0; idx < count; ++idx)
+        corpus.push_back(make());
+    return corpus;
+}
+
+void message_benchmarks()
+{
+    std::mt19937_64 rng{2};
+    const std::size_t count{quick ? 100u : 10'000u};
+    bench_messages("string heavy", make_corpus(count, [&]{ return make_article(rng); }));
+    bench_messages("numeric heavy", make_corpus(count, [&]{ return make_sample(rng); }));
+    bench_messages("nested (depth 12)", make_corpus(count, [&]{ return make_deep(rng); }));
+    const auto books = make_corpus(quick ? 2u : 20u, [&]{ return make_address_book(rng, quick ? 100 : 5000); });
+    bench_messages("wide repeated", books);
+    std::vector<CachedAddressBook> cached_books(books.size());
+    for (std::size_t idx = 0; idx < books.size(); ++idx)
+        cached_books[idx].people.assign(books[idx].people.begin(), books[idx].people.end());
+    bench_messages("wide repeated, cached", cached_books);
+}
+
+int main(int argc, char** argv)
+{
+    for (int idx = 1; idx < argc; ++idx)
+    {
+        if (std::strcmp(argv[idx], "--quick")==0)
+            quick = true;
+        else if (std::strcmp(argv[idx], "--csv")==0)
+            csv = true;
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--quick] [--csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (csv)
+        std::printf("kind,name,case,value1,value2,value3\n");   // varint: ns/value encode, decode; message: MB/s, msgs/s, allocs/msg
+    varint_benchmarks();
+    message_benchmarks();
+    if (!csv)
+        std::printf("(checksum %llu)\n", static_cast<unsigned long long>(checksum));
+    return 0;
+}
@@ -0,0 +1,145 @@
+// GTEST module, built with the instrumentation turned on
+#define TINYPB_INSTRUMENT
+#define TINYPB_INSTRUMENT_SAMPLE 4
+#include "protobuf.h"
+#include "RecordStream.h"
+#include "ReflectionTools.h"
+#include "ThreadPool.h"
+#include <sstream>
+
+#include <gtest/gtest.h>
+
+struct PhoneNumber {
+    std::string number;
+    int32_t type;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(PhoneNumber, 1, number),
+                PROTODECL(PhoneNumber, 2, type)
+        );
+    }
+};
+struct Person {
+    std::string name;
+    int32_t id;
+    std::vector<PhoneNumber> phones;
+    static constexpr auto get_members() {
+        return std::make_tuple(
+                PROTODECL(Person, 1, name),
+                PROTODECL(Person, 2, id),
+                PROTODECL(Person, 3, phones)
+        );
+    }
+};
+
+// the stats of type, or nullptr if there are none
+static const InstrumentTypeStats* find(const std::vector<InstrumentTypeStats>& stats, const std::type_info& type)
+{
+    const auto found = std::find_if(stats.begin(), stats.end(), [&](const auto& s) { return s.type==type.name(); });
+    return found==stats.end() ? nullptr : &*found;
+}
+
+TEST(Instrument, Counters)
+{
+    InstrumentReset();
+    const Person person{.name="a long enough name to be on the heap", .id=0, .phones={{"0123", 1}, {"4567", 2}}};
+    DataBlock data;
+    data << person;
+    Person copy{};
+    const auto read_res = as_const(data) >> copy;
+    EXPECT_TRUE(read_res && read_res.rest().empty());
+    EXPECT_EQ(copy, person);
+
+    const auto stats = InstrumentSnapshot();
+    const auto* found_people = find(stats, typeid(Person));
+    ASSERT_NE(found_people, nullptr);
+    const auto& people = *found_people;
+    EXPECT_EQ(people.encode.calls, 1);
+    EXPECT_EQ(people.encode.bytes, data.size());
+    EXPECT_EQ(people.decode.calls, 1);
+    EXPECT_EQ(people.decode.bytes, data.size());
+    EXPECT_GE(people.decode.allocations, 3);    // the name, and the phones growing twice
+    EXPECT_EQ(people.encode.samples, 1);        // the first call is always timed
+
+    ASSERT_EQ(people.fields.size(), 3);
+    EXPECT_EQ(people.fields[0].field, 1);
+    EXPECT_EQ(people.fields[0].name, "name");
+    EXPECT_EQ(people.fields[0].encoded, 1);
+    EXPECT_EQ(people.fields[0].encoded_bytes, 2+person.name.size());
+    EXPECT_EQ(people.fields[1].encoded, 0);     // id is 0, so not written
+    EXPECT_EQ(people.fields[2].encoded, 2);
+    EXPECT_EQ(people.fields[2].decoded, 2);
+    EXPECT_EQ(people.fields[2].encoded_bytes, people.fields[2].decoded_bytes);
+
+    // embedded messages are counted under their own type
+    const auto* found_phones = find(stats, typeid(PhoneNumber));
+    ASSERT_NE(found_phones, nullptr);
+    const auto& phones = *found_phones;
+    EXPECT_EQ(phones.encode.calls, 2);
+    EXPECT_EQ(phones.decode.calls, 2);
+    EXPECT_EQ(phones.encode.bytes+2*2, people.fields[2].encoded_bytes);
+
+    // a sink that does not know its size is counted through a wrapper
+    std::ostringstream os;
+    StreamSink sink{os};
+    sink << person;
+    const auto streamed = InstrumentSnapshot();
+    ASSERT_NE(find(streamed, typeid(Person)), nullptr);
+    EXPECT_EQ(find(streamed, typeid(Person))->encode.bytes, 2*data.size());
+
+    // and so is a record written to one
+    std::ostringstream records;
+    {
+        StreamSink record_sink{records};
+        WriteDelimited(record_sink, person);
+    }
+    const auto delimited = InstrumentSnapshot();
+    ASSERT_NE(find(delimited, typeid(Person)), nullptr);
+    EXPECT_EQ(find(delimited, typeid(Person))->encode.bytes, 3*data.size());
+    EXPECT_EQ(find(delimited, typeid(Person))->fields[0].encoded_bytes, 3*(2+person.name.size()));
+}
+
+TEST(Instrument, Threads)
+{
+    InstrumentReset();
+    const Person person{.name="Honk", .id=7};
+    DataBlock data;
+    data << person;
+    ThreadPool pool{3};
+    pool.parallel_for(100, [&](std::size_t)
+    {
+        Person copy{};
+        as_const(data) >> copy;
+    });
+    const auto stats = InstrumentSnapshot();
+    const auto* found_people = find(stats, typeid(Person));
+    ASSERT_NE(found_people, nullptr);
+    const auto& people = *found_people;
+    EXPECT_EQ(people.decode.calls, 100);
+    EXPECT_EQ(people.decode.bytes, 100*data.size());
+    EXPECT_EQ(people.fields[1].decoded, 100);
+    EXPECT_GE(people.decode.samples, 100/4);
+
+    // the records of threads that have exited are reused, and what they counted is kept
+    for (int round = 0; round < 10; ++round)
+    {
+        ThreadPool short_lived{3};
+        short_lived.parallel_for(100, [&](std::size_t)
+        {
+            Person copy{};
+            as_const(data) >> copy;
+        });
+    }
+    std::size_t records{0};
+    InstrumentRegistry::get().for_each([&](const InstrumentType& type) { records += *type.type==typeid(Person); });
+    EXPECT_LE(records, 3+3+1);  // pool, short_lived and this thread
+    const auto churned = InstrumentSnapshot();
+    ASSERT_NE(find(churned, typeid(Person)), nullptr);
+    EXPECT_EQ(find(churned, typeid(Person))->decode.calls, 1100);
+
+    const auto text = InstrumentText(stats);
+    EXPECT_NE(text.find("decode: 100 calls"), std::string::npos);
+    const auto json = InstrumentJson(stats);
+    EXPECT_EQ(json.front(), '[');
+    EXPECT_NE(json.find("\"name\":\"name\",\"encoded\":1"), std::string::npos);
+}